@@ -600,17 +600,20 @@ reg [1:0]disk_mount;
 
 
 
+// floppy_track only acts on a rising change, so a toggle would lose every
+// other insert or eject; follow img_mounted instead, one rising edge per
+// mount, with disk_mount already updated when floppy_track samples it
 always @(posedge clk_sys) begin
+	DISK_CHANGE[0] <= img_mounted[0];
 	if (img_mounted[0]) begin
 		disk_mount[0] <= img_size != 0;
-		DISK_CHANGE[0] <= ~DISK_CHANGE[0];
 		//disk_protect <= img_readonly;
 	end
 end
 always @(posedge clk_sys) begin
+	DISK_CHANGE[1] <= img_mounted[1];
 	if (img_mounted[1]) begin
 		disk_mount[1] <= img_size != 0;
-		DISK_CHANGE[1] <= ~DISK_CHANGE[1];
 		//disk_protect <= img_readonly;
 	end
 end
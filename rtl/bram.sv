@@ -33,8 +33,8 @@ module bram #(
     end
 
  
-// Shared memory
-reg [width_a-1:0] mem [(2**widthad_a)-1:0];
+// Shared memory (public so the Verilator harness can load and inspect it)
+reg [width_a-1:0] mem [(2**widthad_a)-1:0] /*verilator public*/;
 
 // Port A
 always @(posedge clock_a) begin
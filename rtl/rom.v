@@ -17,7 +17,7 @@ module rom
 );
 //-------------------------------------------------------------------------------------------------
 
-reg[DW-1:0] d[(2**AW)-1:0];
+reg[DW-1:0] d[(2**AW)-1:0] /*verilator public*/;
 initial $readmemh(FN, d, 0);
 
 always @(posedge clock) if(ce) data_out<= d[a];
@@ -142,7 +142,7 @@ module tk2000 (
     reg cas_o_cs_s;
     reg speaker_cs_s;
     reg softswitch_cs_s;
-    reg [7:0] softswitches_s = 8'b00000000;
+    reg [7:0] softswitches_s /*verilator public*/ = 8'b00000000;
     wire ss_color_s;
     wire ss_motorA_s;
     wire ss_page2_s;
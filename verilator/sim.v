@@ -93,6 +93,8 @@ module emu (
 	input [7:0]		ioctl_dout,
 	input [7:0]		ioctl_index,
 	output reg		ioctl_wait=1'b0,
+	input			ioctl_upload,
+	output [7:0]		ioctl_din,
 
 	output [31:0] 		sd_lba[3],
 	output [9:0] 		sd_rd,
@@ -106,6 +108,7 @@ module emu (
 	input 			img_readonly,
 
 	input [63:0] 		img_size,
+	output [2:0]		disk_busy,		// {cpu_wait_fdd, TRACK2_RAM_BUSY, TRACK1_RAM_BUSY} for the harness stall counters
 
 	input [31:0]		RTC_l,
 	input [31:0]		RTC_h,
@@ -133,9 +136,6 @@ wire [15:0] joys = joystick_a0;
 wire [15:0] joya = {joys[15:8], joys[7:0]};
 wire  [5:0] joyd = joystick_0[5:0] & {2'b11, {2{~|joys[7:0]}}, {2{~|joys[15:8]}}};
 
-assign AUDIO_L = {audio_l,6'b0};
-assign AUDIO_R = {audio_r,6'b0};
-wire [9:0] audio_l, audio_r;
 
 reg ce_pix;
 always @(posedge CLK_VIDEO) begin
@@ -210,6 +210,19 @@ wire [5:0] kbd_cols_s;
 
 // Audio
 wire spk_s;
+assign AUDIO_L = { 2'b0,spk_s,spk_s,12'b0};
+assign AUDIO_R = AUDIO_L;
+
+`ifdef VERILATOR
+// Report speaker toggles to the harness, which timestamps them and
+// synthesises band-limited audio instead of sampling AUDIO_L every clock
+import "DPI-C" function void sim_speaker_edge(input bit level);
+reg spk_last;
+always @(posedge clk_sys) begin
+	spk_last <= spk_s;
+	if (spk_s != spk_last) sim_speaker_edge(spk_s);
+end
+`endif
 
 // K7
 wire cas_o_s;
@@ -418,6 +431,7 @@ dpram  #( .addr_width_g(16),.data_width_g(8)) ram (
 	.wren_a		(ram_we)
 );
 */
+wire [7:0] ram_upload_q;
 bram #(8,16) ram 
 (
         .clock_a(clock_28_s),
@@ -426,12 +440,14 @@ bram #(8,16) ram
         .data_a(ram_data),
         .q_a(ram_data_from_s),
         
+        // read-only port for ioctl uploads (index 0), q_b a clock after ioctl_addr
         .clock_b(clk_sys),
-        .address_b(),
-        .wren_b(),
-        .data_b(),
-        .q_b()
+        .address_b(ioctl_addr[15:0]),
+        .wren_b(1'b0),
+        .data_b(8'h00),
+        .q_b(ram_upload_q)
 );
+assign ioctl_din = (ioctl_upload && ioctl_index == 8'd0) ? ram_upload_q : 8'hFF;
         
 
 
@@ -510,6 +526,7 @@ wire [7:0] TRACK2_RAM_DO;
 wire TRACK2_RAM_WE;
 wire [5:0] TRACK2;
 
+assign disk_busy = { cpu_wait_fdd, TRACK2_RAM_BUSY, TRACK1_RAM_BUSY };
 
 
 disk_ii disk(
@@ -559,17 +576,20 @@ reg [1:0]disk_mount;
 
 
 
+// floppy_track only acts on a rising change, so a toggle would lose every
+// other insert or eject; follow img_mounted instead, one rising edge per
+// mount, with disk_mount already updated when floppy_track samples it
 always @(posedge clk_sys) begin
+	DISK_CHANGE[0] <= img_mounted[0];
 	if (img_mounted[0]) begin
 		disk_mount[0] <= img_size != 0;
-		DISK_CHANGE[0] <= ~DISK_CHANGE[0];
 		//disk_protect <= img_readonly;
 	end
 end
 always @(posedge clk_sys) begin
+	DISK_CHANGE[1] <= img_mounted[1];
 	if (img_mounted[1]) begin
 		disk_mount[1] <= img_size != 0;
-		DISK_CHANGE[1] <= ~DISK_CHANGE[1];
 		//disk_protect <= img_readonly;
 	end
 end
@@ -587,7 +607,7 @@ floppy_track floppy_track_1
 	.track (TRACK1),
 	.busy  (TRACK1_RAM_BUSY),
    .change(DISK_CHANGE[0]),
-   .mount (img_mounted[0]),
+   .mount (disk_mount[0]),
    .ready  (DISK_READY[0]),
    .active (fd_disk_1),
 
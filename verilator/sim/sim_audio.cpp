@@ -2,16 +2,79 @@
 #include <iostream>
 #include <fstream>
 #include <list>
+#include <cmath>
+#include <cstring>
+#include <vector>
 using namespace std;
 
-SimClock clk;
+// Live output needs SDL: always there in the SDL/OpenGL build, optional in
+// headless builds (make headless HEADLESS_SDL_AUDIO=1), not in the DirectX build
+#if !defined(_MSC_VER) && (!defined(SIM_HEADLESS) || defined(SIM_SDL_AUDIO))
+#define HAVE_SDL_AUDIO
+#include <SDL.h>
+#endif
+
 bool outputToFile;
-ofstream audioFile;
+
+static const int ring_frames = 4096;		// ~85ms at 48kHz, rate control aims for half
+static const int rate_update_interval = 128;	// output samples between rate control updates
+static const int fade_samples = 64;
+
+// Integrated windowed sinc (BLEP): 0 at -blep_width/2, 1 at +blep_width/2,
+// sampled at blep_phases points per output sample
+static const int blep_phases = 64;
+static std::vector<float> blep_table;
+
+static void BuildBlep(int width) {
+	const double pi = 3.14159265358979323846;
+	const double cutoff = 0.45;		// cycles per output sample
+	int size = width * blep_phases + 1;
+	std::vector<double> impulse(size);
+	double sum = 0;
+	for (int i = 0; i < size; i++) {
+		double x = (double)i / blep_phases - width / 2.0;
+		double sinc = x == 0 ? 2.0 * cutoff : sin(2.0 * pi * cutoff * x) / (pi * x);
+		double w = (double)i / (size - 1);
+		double blackman = 0.42 - 0.5 * cos(2.0 * pi * w) + 0.08 * cos(4.0 * pi * w);
+		impulse[i] = sinc * blackman;
+		sum += impulse[i];
+	}
+	blep_table.resize(size);
+	double acc = 0;
+	for (int i = 0; i < size; i++) {
+		acc += impulse[i];
+		blep_table[i] = (float)(acc / sum);
+	}
+}
+
+// x in output samples relative to the edge
+static inline float Blep(double x, int width) {
+	double f = (x + width / 2.0) * blep_phases;
+	if (f <= 0) { return 0.0f; }
+	int i = (int)f;
+	if (i >= (int)blep_table.size() - 1) { return 1.0f; }
+	float frac = (float)(f - i);
+	return blep_table[i] + (blep_table[i + 1] - blep_table[i]) * frac;
+}
 
 SimAudio::SimAudio(int systemClockFrequency, bool saveToFile)
 {
-	clk = SimClock(systemClockFrequency / 44100);
 	outputToFile = saveToFile;
+	inputRate = systemClockFrequency;
+	outputRate = 44100;
+	liveOutput = true;
+	rateControl = 0.005f;
+	volume = 1.0f;
+	stats_fill = 0;
+	stats_ratio = 1.0f;
+	stats_underruns = 0;
+	stats_overruns = 0;
+	edgeMode = true;
+	speakerLevel = 0x3000 / 32768.0f;	// AUDIO_L with spk_s high
+	stats_edges = 0;
+	device = 0;
+	primed = false;
+	last = { 0, 0 };
 }
 
 SimAudio::~SimAudio()
@@ -20,43 +83,227 @@ SimAudio::~SimAudio()
 }
 
 void SimAudio::Clock(signed short left, signed short right) {
-	clk.Tick();
-	if (clk.IsRising()) {
-		// Output audio (left channel only for now)
-		float l = left / 32768.0f;
-		if (outputToFile) {
-			audioFile.write((const char*)&l, sizeof(float));
+	float l, r;
+	if (!decimator.Push(left, right, &l, &r)) { return; }
+	scope.Push(l, r);
+
+	// DC blocker: the speaker output is unsigned
+	dc_out_l = l - dc_in_l + 0.995f * dc_out_l;
+	dc_out_r = r - dc_in_r + 0.995f * dc_out_r;
+	dc_in_l = l;
+	dc_in_r = r;
+
+	Output(dc_out_l * volume, dc_out_r * volume);
+}
+
+// Restart the edge timeline at cycle, e.g. after the simulation reset put
+// main_time back to 0.  Steps still being spread are settled at once so the
+// output carries on from the current speaker level.
+void SimAudio::ResetTimeline(uint64_t cycle) {
+	edgeLastCycle = cycle;
+	edgeLastTime = 0;
+	emitIndex = 0;
+	edgeBase = edgeLevel;
+	for (int i = 0; i < blep_buffer; i++) { edgeAcc[i] = edgeSettle[i] = 0; }
+}
+
+// clk_sys cycle to output sample time, 32.32; a cycle behind the last one
+// means the counter was reset, so the timeline restarts there
+uint64_t SimAudio::TimeAt(uint64_t cycle) {
+	if (cycle < edgeLastCycle) { ResetTimeline(cycle); }
+	edgeLastTime += (cycle - edgeLastCycle) * edgeStep;
+	edgeLastCycle = cycle;
+	return edgeLastTime;
+}
+
+void SimAudio::SpeakerEdge(uint64_t cycle, bool level) {
+	if (!edgeMode) { return; }
+	Advance(cycle);
+	stats_edges++;
+
+	float target = level ? speakerLevel : 0.0f;
+	float delta = target - edgeLevel;
+	edgeLevel = target;
+
+	// Spread the step over the samples around the edge; those are all still
+	// ahead of emitIndex because Advance() holds back half a step width
+	double te = edgeLastTime / 4294967296.0;
+	int64_t first = (int64_t)ceil(te - blep_width / 2);
+	int64_t last = (int64_t)floor(te + blep_width / 2);
+	for (int64_t n = first; n <= last; n++) {
+		edgeAcc[n & (blep_buffer - 1)] += delta * Blep(n - te, blep_width);
+	}
+	edgeSettle[(last + 1) & (blep_buffer - 1)] += delta;
+}
+
+void SimAudio::Advance(uint64_t cycle) {
+	if (!edgeMode) { return; }
+	uint64_t t = TimeAt(cycle);
+	while (((emitIndex + blep_width / 2) << 32) < t) {
+		int i = emitIndex & (blep_buffer - 1);
+		edgeBase += edgeSettle[i];
+		float sample = edgeBase + edgeAcc[i];
+		edgeSettle[i] = 0;
+		edgeAcc[i] = 0;
+		emitIndex++;
+		Emit(sample);
+	}
+}
+
+void SimAudio::Emit(float sample) {
+	scope.Push(sample, sample);
+	// DC blocker as in Clock(), the speaker is mono
+	dc_out_l = sample - dc_in_l + 0.995f * dc_out_l;
+	dc_in_l = sample;
+	Output(dc_out_l * volume, dc_out_l * volume);
+}
+
+void SimAudio::Output(float l, float r) {
+	if (wav.IsOpen()) { wav.Write(l, r); }
+	if (!device) { return; }
+
+	if (!ring.Push({ l, r })) { stats_overruns++; }
+
+	// Dynamic rate control: a fuller ring means fewer output samples per
+	// emulated second, an emptier one more
+	if (++rateCounter >= rate_update_interval) {
+		rateCounter = 0;
+		stats_fill = (float)ring.Size() / ring.Capacity();
+		stats_ratio = 1.0f + rateControl * (2.0f * stats_fill - 1.0f);
+		decimator.SetRateAdjust(stats_ratio);
+		edgeStep = (uint64_t)(edgeStepNominal / stats_ratio);
+	}
+}
+
+// SDL audio thread.  Pops what the simulation has produced; when the ring runs
+// dry the output fades to silence and stays silent until the ring is half
+// full again, so a slow simulation stutters cleanly instead of crackling.
+void SimAudio::Callback(void* userdata, unsigned char* stream, int len) {
+	SimAudio* audio = (SimAudio*)userdata;
+	SimAudio_Frame* out = (SimAudio_Frame*)stream;
+	size_t count = len / sizeof(SimAudio_Frame);
+	size_t got = 0;
+
+	if (!audio->primed && audio->ring.Size() >= audio->ring.Capacity() / 2) { audio->primed = true; }
+	if (audio->primed) {
+		got = audio->ring.Pop(out, count);
+		if (got) { audio->last = out[got - 1]; }
+	}
+	if (got < count) {
+		if (audio->primed) {
+			audio->stats_underruns++;
+			audio->primed = false;
+		}
+		for (size_t i = got; i < count; i++) {
+			float fade = i - got < (size_t)fade_samples ? 1.0f - (float)(i - got + 1) / fade_samples : 0.0f;
+			out[i].l = audio->last.l * fade;
+			out[i].r = audio->last.r * fade;
 		}
+		audio->last = { 0, 0 };
 	}
 }
 
-void SimAudio::CollectDebug(signed short left, signed short right) {
-	float vol_l = left / 32768.0f;
-	float vol_r = right / 32768.0f;
-	debug_pos++;
-	if (debug_pos == debug_max_samples) { debug_pos = 0; }
-	debug_wave_l[debug_pos] = vol_l;
-	debug_wave_r[debug_pos] = vol_r;
+SimAudioScope::SimAudioScope()
+{
+	trigger = SimAudioScope_Rising;
+	triggerLevel = 0.1f;
+	window = 1024;
+	hold = false;
+	triggered = false;
+	samples_l.assign(capacity, 0.0f);
+	samples_r.assign(capacity, 0.0f);
+	written = 0;
+}
+
+int SimAudioScope::Capture(int rate) {
+	if (window > capacity / 2) { window = capacity / 2; }
+	if (hold || written < (uint64_t)window) { return (int)view_t.size(); }
 
+	// Trigger a quarter of the way into the window; search newest first
+	int pre = window / 4;
+	uint64_t start = written - window;
+	triggered = false;
+	if (trigger != SimAudioScope_Free) {
+		uint64_t oldest = written > (uint64_t)capacity ? written - capacity + 1 : 1;
+		for (uint64_t i = written - (window - pre); i > oldest + pre && i >= (uint64_t)pre + 1; i--) {
+			float a = samples_l[(i - 1) & (capacity - 1)];
+			float b = samples_l[i & (capacity - 1)];
+			bool cross = trigger == SimAudioScope_Rising ? (a < triggerLevel && b >= triggerLevel) : (a > triggerLevel && b <= triggerLevel);
+			if (cross) {
+				start = i - pre;
+				triggered = true;
+				break;
+			}
+		}
+	}
+
+	view_t.resize(window);
+	view_l.resize(window);
+	view_r.resize(window);
+	float ms = 1000.0f / rate;
+	for (int n = 0; n < window; n++) {
+		int i = (int)((start + n) & (capacity - 1));
+		view_t[n] = (n - (triggered ? pre : 0)) * ms;
+		view_l[n] = samples_l[i];
+		view_r[n] = samples_r[i];
+	}
+	return window;
 }
 
 void SimAudio::Initialise() {
-	// Reset plot data
-	for (int c = 0; c < debug_max_samples; c++) {
-		debug_wave_l[c] = 0;
-		debug_wave_r[c] = 0;
-		debug_positions[c] = (double)c / (double)debug_max_samples;
+#ifdef HAVE_SDL_AUDIO
+	if (liveOutput) {
+		SDL_AudioSpec want, have;
+		memset(&want, 0, sizeof(want));
+		want.freq = outputRate;
+		want.format = AUDIO_F32SYS;
+		want.channels = 2;
+		want.samples = 512;
+		want.callback = Callback;
+		want.userdata = this;
+		if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+			fprintf(stderr, "audio: %s\n", SDL_GetError());
+		}
+		else {
+			device = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+			if (!device) {
+				fprintf(stderr, "audio: %s\n", SDL_GetError());
+			}
+			else {
+				outputRate = have.freq;
+				printf("audio: %s driver, %d Hz\n", SDL_GetCurrentAudioDriver(), outputRate);
+			}
+		}
 	}
-	if (outputToFile)
+#endif
+
+	decimator.Configure(inputRate, outputRate);
+
+	BuildBlep(blep_width);
+	edgeStepNominal = (uint64_t)llround((double)outputRate / inputRate * 4294967296.0);
+	edgeStep = edgeStepNominal;
+	edgeLevel = 0;
+	ResetTimeline(0);
+	dc_in_l = dc_in_r = dc_out_l = dc_out_r = 0;
+	rateCounter = 0;
+	ring.Resize(ring_frames);
+
+#ifdef HAVE_SDL_AUDIO
+	if (device) { SDL_PauseAudioDevice(device, 0); }
+#endif
+
+	if (outputToFile && !wav.IsOpen())
 	{
 		// Setup Audio output stream
-		audioFile.open("audio.wav", ios::binary);
+		wav.Open("audio.wav", outputRate, SimWav_Float);
 	}
 }
 void SimAudio::CleanUp() {
-	if (outputToFile)
-	{
-		audioFile.close();
+#ifdef HAVE_SDL_AUDIO
+	if (device) {
+		SDL_CloseAudioDevice(device);
+		device = 0;
 	}
+#endif
+	wav.Close();
 }
-
@@ -1,23 +1,126 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <string>
+#include <vector>
 #include "sim_clock.h"
+#include "sim_ringbuffer.h"
+#include "sim_resampler.h"
+#include "sim_wav.h"
+
+struct SimAudio_Frame {
+	float l;
+	float r;
+};
+
+enum SimAudioScope_Trigger {
+	SimAudioScope_Free,
+	SimAudioScope_Rising,
+	SimAudioScope_Falling
+};
+
+// Oscilloscope over the last second or so of output, one entry per output
+// sample (before DC removal and volume).  Capture() picks the newest trigger
+// crossing that leaves a full window and copies that window out for plotting,
+// so the per GUI frame cost is one window, not the history.
+struct SimAudioScope {
+public:
+
+	static const int capacity = 65536;
+
+	SimAudioScope_Trigger trigger;
+	float triggerLevel;
+	int window;				// samples shown
+	bool hold;				// stop updating the view
+	bool triggered;			// last Capture() found a crossing
+
+	std::vector<float> view_t;	// ms relative to the trigger point
+	std::vector<float> view_l;
+	std::vector<float> view_r;
+
+	void Push(float l, float r) {
+		int i = (int)(written & (capacity - 1));
+		samples_l[i] = l;
+		samples_r[i] = r;
+		written++;
+	}
+	int Capture(int rate);
+
+	SimAudioScope();
+
+private:
+	std::vector<float> samples_l;
+	std::vector<float> samples_r;
+	uint64_t written;
+};
 
 struct SimAudio {
 public:
 
 	SimClock clock;
-	
-	static const unsigned short debug_max_samples = 600;
-	float debug_positions[debug_max_samples];
-	float debug_wave_l[debug_max_samples];
-	float debug_wave_r[debug_max_samples];
-	int debug_pos;
+	SimAudioScope scope;
+
+	// Live output through SDL.  Clock() takes one sample per clk_sys rising
+	// edge and decimates it (SimDecimator) into a lock-free ring that the audio
+	// callback drains; dynamic rate control nudges the resampling step by up to
+	// rateControl so the ring hovers around half full whatever the simulation
+	// speed.  Works with SDL_AUDIODRIVER=dummy or disk.
+	bool liveOutput;
+	int outputRate;
+	SimWavWriter wav;		// optional archive of the output stream
+	float rateControl;
+	float volume;
+
+	// Edge mode: sim.v reports speaker toggles (DPI sim_speaker_edge) and the
+	// output is built from band-limited steps at their exact cycle times, so
+	// the cost follows the toggle rate instead of the 14 MHz clock.  Clock()
+	// is not needed in this mode; Advance() emits samples up to a cycle.
+	bool edgeMode;
+	float speakerLevel;		// output amplitude of a high speaker
+
+	float stats_fill;					// ring fill 0..1 at the last rate update
+	float stats_ratio;					// current step / nominal step
+	std::atomic<int> stats_underruns;	// callbacks that ran dry (output faded to silence)
+	int stats_overruns;					// samples dropped because the ring was full
+	int stats_edges;
 
 	SimAudio(int systemClockFrequency, bool saveToFile);
 	~SimAudio();
 	void Clock(signed short left, signed short right);
-	void CollectDebug(signed short left, signed short right);
+	void SpeakerEdge(uint64_t cycle, bool level);
+	void Advance(uint64_t cycle);
+	void ResetTimeline(uint64_t cycle);
 	void Initialise();
 	void CleanUp();
+
+private:
+	int inputRate;
+	SimDecimator decimator;
+	float dc_in_l, dc_in_r, dc_out_l, dc_out_r;
+	int rateCounter;
+
+	// Edge mode timeline: output samples in 32.32 fixed point
+	static const int blep_width = 32;		// samples covered by one step
+	static const int blep_buffer = 64;
+	uint64_t edgeStepNominal;
+	uint64_t edgeStep;			// output samples per clk_sys cycle, rate control applied
+	uint64_t edgeLastCycle;
+	uint64_t edgeLastTime;
+	uint64_t emitIndex;			// next output sample to emit
+	float edgeBase;				// settled level of all steps already complete
+	float edgeLevel;			// level after the last edge
+	float edgeAcc[blep_buffer];	// step shapes not yet emitted, by output sample
+	float edgeSettle[blep_buffer];	// step heights joining edgeBase at that sample
+
+	uint64_t TimeAt(uint64_t cycle);
+	void Emit(float sample);
+
+	SimRingBuffer<SimAudio_Frame> ring;
+	unsigned int device;
+	bool primed;		// consumer waits for half a ring after an underrun
+	SimAudio_Frame last;
+
+	void Output(float l, float r);
+	static void Callback(void* userdata, unsigned char* stream, int len);
 };
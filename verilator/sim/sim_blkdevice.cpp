@@ -1,3 +1,6 @@
+#include <cmath>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 #include <queue>
 #include <string>
@@ -35,136 +38,415 @@ QData* img_size=NULL;
 #define bitcheck(byte,nbit) ((byte) &   (1<<(nbit)))
 
 
+// Mounting or ejecting replaces the image under a running core: a request
+// still in flight would mix the two images, so it is dropped.  floppy_track
+// drops its side of it too when the mount pulse arrives.
 void SimBlockDevice::MountDisk( std::string file, int index) {
-	disk[index].open(file.c_str(), std::ios::out | std::ios::in | std::ios::binary | std::ios::ate);
-        if (disk[index]) {
-		fprintf(stderr,"we are here\n");
-           // we shouldn't do the actual mount here..
-           disk_size[index]= disk[index].tellg();
-	//fprintf(stderr,"mount size %ld\n",disk_size[index]);
-           disk[index].seekg(0);
-           mountQueue[index]=1;
-           printf("disk %d inserted (%s)\n",index,file.c_str());
+	// nothing for the old image may still be in flight
+	writeback.Flush(true);
+	AbortRequest(index);
+	std::lock_guard<std::mutex> guard(imageLock);
+	disk[index].overlay = overlayMode;
+	disk[index].overlayExit = overlayExit;
+	disk[index].deltaDir = overlayDir;
+	trackCache.Invalidate(index);
+	lastTrack[index] = 0;
+	headDirection[index] = 1;
+	playlistPos[index] = -1;	// SelectDisk sets it after
+	if (disk[index].Open(file, false)) {
+           SimWriteBack::Recover(disk[index]);
+           disk_size[index]= disk[index].size;
+           stats_drive[index].image = file;
+           if (trace) printf("disk %d inserted (%s)%s\n",index,file.c_str(),disk[index].readonly?" read-only":"");
         }else {
-		fprintf(stderr,"some kind of error: %s\n",file.c_str());
+		fprintf(stderr,"cannot open disk image %s, drive %d is empty\n",file.c_str(),index);
+		disk_size[index]=0;
+		stats_drive[index].image.clear();
 	}
+	// the core learns about it on the next img_mounted pulse
+	mountQueue[index]=1;
+	bitset(activeDrives,index);
+}
 
+void SimBlockDevice::EjectDisk(int index) {
+	writeback.Flush(true);
+	AbortRequest(index);
+	std::lock_guard<std::mutex> guard(imageLock);
+	trackCache.Invalidate(index);
+	disk[index].Close();
+	disk_size[index]=0;
+	stats_drive[index].image.clear();
+	mountQueue[index]=1;
+	bitset(activeDrives,index);
+	if (trace) printf("disk %d ejected\n",index);
 }
 
+bool SimBlockDevice::LoadPlaylist(int index, std::string list) {
+	std::vector<std::string> entries;
+	std::ifstream in(list);
+	if (in) {
+		std::string line;
+		while (std::getline(in, line)) {
+			if (!line.empty() && line.back() == '\r') line.pop_back();
+			if (line.empty() || line[0] == '#') continue;
+			entries.push_back(line);
+		}
+	} else {
+		size_t start = 0;
+		while (start <= list.size()) {
+			size_t end = list.find(',', start);
+			if (end == std::string::npos) end = list.size();
+			if (end > start) entries.push_back(list.substr(start, end - start));
+			start = end + 1;
+		}
+	}
+	if (entries.empty()) return false;
+	playlist[index] = entries;
+	playlistPos[index] = -1;
+	return true;
+}
+
+void SimBlockDevice::SelectDisk(int index, int position) {
+	int count = (int)playlist[index].size();
+	if (!count) return;
+	position = ((position % count) + count) % count;
+	MountDisk(playlist[index][position], index);
+	playlistPos[index] = position;
+}
 
-void SimBlockDevice::BeforeEval(int cycles)
+// Forget whatever the drive was doing; the bus and sd_ack are released if it
+// was transferring
+void SimBlockDevice::AbortRequest(int i)
 {
-//
-// switch to a new disk if current_disk is -1
-// check to see if we need a read or a write or a mount
-//
+	SimBlockDevice_Drive& d = drive[i];
+	if (d.state == SimBlockDevice_Mounting) return;
+	if (d.state == SimBlockDevice_Transfer) {
+		*sd_buff_wr = 0;
+		busOwner = -1;
+	}
+	if (d.state != SimBlockDevice_Idle && sd_ack) bitclear(*sd_ack,i);
+	d.state = SimBlockDevice_Idle;
+}
 
+
+bool SimBlockDevice::LatencyFromName(std::string name, SimBlockDevice_Latency* model) {
+	if (name == "fixed") { *model = SimBlockDevice_Fixed; }
+	else if (name == "realistic" || name == "sd") { *model = SimBlockDevice_Realistic; }
+	else if (name == "instant" || name == "none") { *model = SimBlockDevice_Instant; }
+	else { return false; }
+	return true;
+}
+
+// Cycles between a request (or mount) and sd_ack.  The countdown ends at 1,
+// so 1 is the shortest possible wait.
+int SimBlockDevice::RequestLatency(bool write)
+{
+	if (latencyModel == SimBlockDevice_Instant) return 1;
+	if (latencyModel == SimBlockDevice_Fixed) return latencyCycles > 1 ? latencyCycles : 1;
+
+	// xorshift32, fixed seed so runs repeat exactly
+	random ^= random << 13;
+	random ^= random >> 17;
+	random ^= random << 5;
+
+	// Roughly log-normal around latencyCycles: sum of three uniforms spread
+	// over a quarter to four times the median, writes twice as slow, and one
+	// request in 128 hitting a flash housekeeping stall of 20x
+	int spread = (int)(random & 0xFF) + (int)((random >> 8) & 0xFF) + (int)((random >> 16) & 0xFF) - 384;
+	double cycles = latencyCycles * pow(2.0, spread / 96.0);
+	if (write) cycles *= 2;
+	if (((random >> 24) & 0x7F) == 0) cycles *= 20;
+	return cycles > 1 ? (int)cycles : 1;
+}
+
+// Sector access for the simulation side: written sectors still waiting in
+// the write-back cache take precedence over the image
+void SimBlockDevice::DiskRead(int drive, uint32_t lba, uint8_t* buffer)
+{
+	if (writeback.Read(drive, lba, buffer)) return;
+	std::lock_guard<std::mutex> guard(imageLock);
+	disk[drive].Read(lba, buffer);
+}
+
+bool SimBlockDevice::DiskWrite(int drive, uint32_t lba, const uint8_t* buffer)
+{
+	if (disk[drive].readonly || (uint64_t)lba * kBLKSZ >= disk[drive].size) return false;
+	if (writeback.enabled) {
+		writeback.Write(drive, lba, buffer);
+		return true;
+	}
+	std::lock_guard<std::mutex> guard(imageLock);
+	return disk[drive].Write(lba, buffer);
+}
+
+// Stage a whole nibble track in the track cache
+uint8_t* SimBlockDevice::StageTrack(int drive, int track, bool prefetch)
+{
+	if (track < 0 || track >= disk[drive].Tracks()) return NULL;
+	uint8_t* buffer = trackCache.Insert(drive, track, prefetch);
+	for (int s=0; s<kTRACKSECTORS; s++) DiskRead(drive, track * kTRACKSECTORS + s, buffer + s * kBLKSZ);
+	if (prefetch) trackCache.stats_prefetches++;
+	return buffer;
+}
+
+// Fill 'sector' for a read; true when it came from a track already staged.
+// floppy_track loads a track as 13 consecutive sectors, so the first sector
+// of a track counts the hit or miss and moves the prefetch window.
+bool SimBlockDevice::ReadSector(int drive, int lba, uint8_t* sector)
+{
+	if (!trackCache.capacity || !disk[drive].Tracks()) {
+		DiskRead(drive, lba, sector);
+		return false;
+	}
+
+	int track = lba / kTRACKSECTORS;
+	bool prefetched = false;
+	uint8_t* buffer = trackCache.Find(drive, track, &prefetched);
+	bool hit = buffer != NULL;
+	if (lba % kTRACKSECTORS == 0) {
+		if (hit) trackCache.stats_hits++; else trackCache.stats_misses++;
+		if (prefetched) trackCache.stats_prefetchHits++;
+
+		// the head steps a track at a time, usually on in the same direction
+		if (track != lastTrack[drive]) headDirection[drive] = track > lastTrack[drive] ? 1 : -1;
+		lastTrack[drive] = track;
+	}
+	if (!buffer) buffer = StageTrack(drive, track, false);
+	if (!buffer) {
+		DiskRead(drive, lba, sector);
+		return false;
+	}
+	memcpy(sector, buffer + (lba % kTRACKSECTORS) * kBLKSZ, kBLKSZ);
+
+	if (lba % kTRACKSECTORS == 0) {
+		int ahead[3] = { track + headDirection[drive], track + 2 * headDirection[drive], track - headDirection[drive] };
+		for (int n=0; n<3; n++) {
+			if (!trackCache.Contains(drive, ahead[n])) StageTrack(drive, ahead[n], true);
+		}
+	}
+	return hit;
+}
+
+void SimBlockDevice::StartRequest(int i, bool write)
+{
+	SimBlockDevice_Drive& d = drive[i];
+	SimBlockDevice_Stats& s = stats_drive[i];
+	d.write = write;
+	d.lba = *(sd_lba[i]);
+	d.requestCycle = now;
+	if (s.reads + s.writes) {
+		s.spacing.Add(now - s.lastRequest);
+		if (d.lba != s.lastLba + 1) s.seeks++;
+	}
+	s.lastRequest = now;
+	s.lastLba = d.lba;
+	bool staged = false;
+	if (!write) {
+		staged = ReadSector(i, d.lba, d.buffer);
+		stats_reads++;
+		s.reads++;
+		s.bytesRead += kBLKSZ;
+		if (staged) s.cacheHits++;
+	} else {
+		s.writes++;
+		s.bytesWritten += kBLKSZ;
+	}
+	if (trace) printf("seek %06X lba: (%x) (%d,%d) drive %d reading %d writing %d ack %x\n", d.lba * kBLKSZ, d.lba, d.lba, kBLKSZ, i, !write, write, *sd_ack);
+	// tracks already staged on the host don't wait for the card
+	d.delay = staged ? 1 : RequestLatency(write);
+	d.state = SimBlockDevice_Waiting;
+	bitset(activeDrives,i);
+}
+
+// One clock of the bus owner's transfer
+void SimBlockDevice::TransferStep(int i)
+{
+	SimBlockDevice_Drive& d = drive[i];
+	bool done = false;
+
+	if (!d.write) {
+		if (*sd_buff_wr==0 && d.bytecnt<kBLKSZ) {
+			*sd_buff_dout = d.buffer[d.bytecnt];
+			*sd_buff_addr = d.bytecnt++;
+			*sd_buff_wr = 1;
+		} else {
+			*sd_buff_wr = 0;
+			done = d.bytecnt==kBLKSZ;
+		}
+	} else {
+		// the core's buffer answers a clock after sd_buff_addr moves
+		if (*sd_buff_addr != d.bytecnt && *sd_buff_addr < kBLKSZ) {
+			d.buffer[*sd_buff_addr] = *(sd_buff_din[i]);
+			*sd_buff_addr = d.bytecnt;
+		} else {
+			*sd_buff_wr = 0;
+			if (d.bytecnt>=kBLKSZ) done = true;
+			else d.bytecnt++;
+		}
+		if (done) {
+			// whole sector received, store it in one go
+			if (DiskWrite(i, d.lba, d.buffer) && trackCache.capacity && disk[i].Tracks()) {
+				// keep a staged copy of the track in step (write-through)
+				uint8_t* track = trackCache.Find(i, d.lba / kTRACKSECTORS, NULL);
+				if (track) memcpy(track + (d.lba % kTRACKSECTORS) * kBLKSZ, d.buffer, kBLKSZ);
+			}
+			stats_writes++;
+		}
+	}
+
+	if (done) {
+		bitclear(*sd_ack,i);
+		d.state = SimBlockDevice_Idle;
+		busOwner = -1;
+	}
+}
+
+void SimBlockDevice::BeforeEval(uint64_t cycles)
+{
 // wait until the computer boots to start mounting, etc
  if (cycles<2000) return;
+ now = cycles;
 
- for (int i=0; i<kVDNUM;i++)
- {
+ if (*disk_busy) {
+    if (bitcheck(*disk_busy,0)) stats_trackBusy[0]++;
+    if (bitcheck(*disk_busy,1)) stats_trackBusy[1]++;
+    if (bitcheck(*disk_busy,2)) stats_cpuWait++;
+ }
 
-//fprintf(stderr,"current_disk = %d *sd_rd %x ack_delay %x reading %d writing %d\n",current_disk,*sd_rd,ack_delay,reading,writing);
-
-    if (current_disk == i) {
-    // send data
-    if (ack_delay==1) {
-      if (reading && (*sd_buff_wr==0) &&  (bytecnt<kBLKSZ)) {
-         *sd_buff_dout = disk[i].get();
-         *sd_buff_addr = bytecnt++;
-         *sd_buff_wr= 1;
-         //printf("cycles %x reading %X : %X ack %x\n",cycles,*sd_buff_addr,*sd_buff_dout,*sd_ack );
-      } else if(writing && *sd_buff_addr != bytecnt && (*sd_buff_addr< kBLKSZ)) {
-      //} else if(writing && (bytecnt < kBLKSZ)) {
-  	//printf("writing disk %i at sd_buff_addr %x data %x ack %x\n",i,*sd_buff_addr,*sd_buff_din[i],*sd_ack);
-        disk[i].put(*(sd_buff_din[i]));
-        *sd_buff_addr = bytecnt;
-      } else {
-	  *sd_buff_wr=0;
-
-	  if (writing) {
-		  if (bytecnt>=kBLKSZ) {
-			  writing=0;
-			  //printf("writing stopped: bytecnt %x sd_buff_addr %x \n",bytecnt,*sd_buff_addr);
-		  }
-		  if (bytecnt<kBLKSZ)
-		  	bytecnt++;
-	  }
-	  else if (reading) {
-        	if(bytecnt == kBLKSZ) {
-         	 	reading = 0;
-        	} 
-        }
-      }
-    } else {
-	  *sd_buff_wr=0;
-    } 
-    }
+ // only drives with a mount queued, a request, or one in flight
+ uint32_t requests = *sd_rd | *sd_wr;
+ uint32_t active = activeDrives | requests;
+ if (!active) return;
 
-    // issue a mount if we aren't doing anything, and the img_mounted has no bits set
-    if (!reading && !writing && mountQueue[i] && !*img_mounted) {
-fprintf(stderr,"mounting.. %d\n",i);
-           mountQueue[i]=0;
-           *img_size = disk_size[i];
-	   *img_readonly=0;
-fprintf(stderr,"img_size .. %ld\n",*img_size);
-           disk[i].seekg(0);
-           bitset(*img_mounted,i);
-           ack_delay=1200;
-    } else if (ack_delay==1 && bitcheck(*img_mounted,i) ) {
-fprintf(stderr,"mounting flag cleared  %d\n",i);
-        bitclear(*img_mounted,i) ;
-        //*img_size = 0;
-    } else { if (!reading && !writing && ack_delay>0) ack_delay--; }
-
-    // start reading when sd_rd pulses high
-    if ((current_disk==-1 || current_disk==i) && (bitcheck(*sd_rd,i) || bitcheck(*sd_wr,i) )) {
-       // set current disk here..
-//fprintf(stderr,"setting current disk %d %x ack_delay %x\n",i,*sd_rd,ack_delay);
-       current_disk=i;
-      if (!ack_delay) {
-        int lba = *(sd_lba[i]);
-        if (bitcheck(*sd_rd,i)) {
-        	reading = true;
-	} 
-        if (bitcheck(*sd_wr,i)) {
-        	writing = true;
-	} 
-
-        disk[i].clear();
-        disk[i].seekg((lba) * kBLKSZ);
-        printf("seek %06X lba: (%x) (%d,%d) drive %d reading %d writing %d ack %x\n", (lba) * kBLKSZ,lba,lba,kBLKSZ,i,reading,writing,*sd_ack);
-        bytecnt = 0;
-        *sd_buff_addr = 0;
-        ack_delay = 1200;
-      }
+ if (busOwner != -1) TransferStep(busOwner);
+
+ int waiting = 0;
+ for (int i=0; i<kVDNUM; i++)
+ {
+    if (!bitcheck(active,i)) continue;
+    SimBlockDevice_Drive& d = drive[i];
+
+    switch (d.state) {
+    case SimBlockDevice_Idle:
+       // a swapped disk is announced before any further request is served
+       if (mountQueue[i] && mountOwner==-1) {
+          // img_size is shared, so one mount at a time
+          if (trace) printf("mounting.. %d\n",i);
+          mountQueue[i]=0;
+          stats_drive[i].mounts++;
+          mountOwner=i;
+          *img_size = disk_size[i];
+          *img_readonly = disk[i].readonly;
+          if (trace) printf("img_size .. %llu\n",(unsigned long long)*img_size);
+          bitset(*img_mounted,i);
+          // img_mounted has to stay up for at least one clock
+          d.delay = RequestLatency(false);
+          if (d.delay < 2) d.delay = 2;
+          d.state = SimBlockDevice_Mounting;
+       } else if (bitcheck(requests,i)) {
+          StartRequest(i, !bitcheck(*sd_rd,i));
+       } else if (!mountQueue[i]) {
+          bitclear(activeDrives,i);
+       }
+       break;
+    case SimBlockDevice_Waiting:
+       if (d.delay > 1) d.delay--;
+       else d.state = SimBlockDevice_Ready;
+       break;
+    case SimBlockDevice_Mounting:
+       if (--d.delay <= 0) {
+          if (trace) printf("mounting flag cleared  %d\n",i);
+          bitclear(*img_mounted,i);
+          mountOwner = -1;
+          d.state = SimBlockDevice_Idle;
+       }
+       break;
+    default:
+       break;
     }
+    if (d.state == SimBlockDevice_Waiting || d.state == SimBlockDevice_Ready) waiting++;
+ }
+ if (waiting) stats_latency++;
+ if (waiting + (busOwner != -1) > 1) stats_overlap++;
 
-    if (current_disk == i) {
-      if (ack_delay==1) {
-           bitset(*sd_ack,i);
-	   //printf("setting sd_ack: %x\n",*sd_ack);
-      } else {
-           bitclear(*sd_ack,i);
-	   //printf("clearing sd_ack: %x\n",*sd_ack);
-      }
-      if((ack_delay > 1) || ((ack_delay == 1) && !reading && !writing))
-        ack_delay--;
-      if (ack_delay==0 && !reading && !writing) 
-	current_disk=-1;
+ // grant the bus, round-robin from the drive after the last owner
+ if (busOwner == -1) {
+    for (int n=1; n<=kVDNUM; n++) {
+       int i = (lastOwner + n) % kVDNUM;
+       if (drive[i].state != SimBlockDevice_Ready) continue;
+       SimBlockDevice_Drive& d = drive[i];
+       d.state = SimBlockDevice_Transfer;
+       d.bytecnt = 0;
+       *sd_buff_addr = 0;
+       *sd_buff_wr = 0;
+       bitset(*sd_ack,i);
+       stats_drive[i].ackLatency.Add(now - d.requestCycle);
+       busOwner = lastOwner = i;
+       break;
     }
-  }
+ }
 }
 
 void SimBlockDevice::AfterEval()
 {
 }
 
+bool SimBlockDevice::WriteStats(const char* file, int clockFrequency)
+{
+	FILE* out = fopen(file, "w");
+	if (!out) return false;
+	fprintf(out, "{\n  \"clock_hz\": %d,\n", clockFrequency);
+	fprintf(out, "  \"reads\": %d, \"writes\": %d, \"latency_cycles\": %llu, \"overlap_cycles\": %llu,\n", stats_reads, stats_writes, (unsigned long long)stats_latency, (unsigned long long)stats_overlap);
+	fprintf(out, "  \"track_busy_cycles\": [%llu, %llu], \"cpu_wait_cycles\": %llu,\n", (unsigned long long)stats_trackBusy[0], (unsigned long long)stats_trackBusy[1], (unsigned long long)stats_cpuWait);
+	fprintf(out, "  \"track_cache\": { \"hits\": %d, \"misses\": %d, \"prefetches\": %d, \"prefetch_hits\": %d },\n", trackCache.stats_hits, trackCache.stats_misses, trackCache.stats_prefetches, trackCache.stats_prefetchHits);
+	fprintf(out, "  \"writeback\": { \"coalesced\": %d, \"flushed\": %d, \"flushes\": %d },\n", writeback.stats_coalesced.load(), writeback.stats_flushed.load(), writeback.stats_flushes.load());
+	fprintf(out, "  \"drives\": [");
+	bool first = true;
+	for (int i=0; i<kVDNUM; i++) {
+		SimBlockDevice_Stats& s = stats_drive[i];
+		if (s.image.empty() && !s.reads && !s.writes) continue;
+		fprintf(out, "%s\n    { \"drive\": %d, \"image\": \"", first ? "" : ",", i);
+		for (char c : s.image) {
+			if (c == '"' || c == '\\') fputc('\\', out);
+			fputc(c, out);
+		}
+		fprintf(out, "\", \"mounts\": %llu, \"reads\": %llu, \"writes\": %llu, \"bytes_read\": %llu, \"bytes_written\": %llu, \"seeks\": %llu, \"cache_hits\": %llu,\n",
+			(unsigned long long)s.mounts, (unsigned long long)s.reads, (unsigned long long)s.writes, (unsigned long long)s.bytesRead, (unsigned long long)s.bytesWritten, (unsigned long long)s.seeks, (unsigned long long)s.cacheHits);
+		fprintf(out, "      \"ack_latency\": ");
+		s.ackLatency.WriteJson(out);
+		fprintf(out, ",\n      \"spacing\": ");
+		s.spacing.WriteJson(out);
+		fprintf(out, " }");
+		first = false;
+	}
+	fprintf(out, "\n  ]\n}\n");
+	fclose(out);
+	return true;
+}
+
+void SimBlockDevice::Initialise()
+{
+	writeback.Start();
+}
+
+void SimBlockDevice::CleanUp()
+{
+	writeback.Stop();
+	std::lock_guard<std::mutex> guard(imageLock);
+	for (int i=0; i<kVDNUM; i++) disk[i].Close();
+}
+
 
-SimBlockDevice::SimBlockDevice(DebugConsole c) {
+SimBlockDevice::SimBlockDevice(DebugConsole c) : writeback(disk, kVDNUM, imageLock) {
 	console = c;
-        current_disk=-1;
+        activeDrives=0;
+        busOwner=-1;
+        lastOwner=kVDNUM-1;
+        mountOwner=-1;
+        stats_reads=0;
+        stats_writes=0;
+        trace=false;
+        now=0;
 
         sd_rd = NULL;
         sd_wr = NULL;
@@ -175,11 +457,32 @@ SimBlockDevice::SimBlockDevice(DebugConsole c) {
            sd_lba[i] = NULL;
 	   sd_buff_din[i] = NULL;
            mountQueue[i]=0;
+           drive[i].state=SimBlockDevice_Idle;
+           drive[i].write=false;
+           drive[i].delay=0;
+           drive[i].bytecnt=0;
+           drive[i].lba=0;
+           drive[i].requestCycle=0;
+           stats_drive[i] = SimBlockDevice_Stats();
+           lastTrack[i]=0;
+           headDirection[i]=1;
+           playlistPos[i]=-1;
+           disk_size[i]=0;
         }
         sd_buff_wr=NULL;
         img_mounted=NULL;
         img_readonly=NULL;
         img_size=NULL;
+        disk_busy=NULL;
+        overlayMode=SimDiskImage_Direct;
+        overlayExit=SimDiskImage_Discard;
+        latencyModel=SimBlockDevice_Fixed;
+        latencyCycles=1200;
+        random=0x544B3230;
+        stats_latency=0;
+        stats_overlap=0;
+        stats_trackBusy[0]=stats_trackBusy[1]=0;
+        stats_cpuWait=0;
 }
 
 SimBlockDevice::~SimBlockDevice() {
@@ -1,8 +1,13 @@
 #pragma once
 #include <iostream>
-#include <fstream>
 #include "verilated.h"
 #include "sim_console.h"
+#include "sim_diskimage.h"
+#include "sim_histogram.h"
+#include "sim_trackcache.h"
+#include "sim_writeback.h"
+#include <mutex>
+#include <vector>
 
 
 #ifndef _MSC_VER
@@ -12,7 +17,55 @@
 
 #define kVDNUM 10
 #define kBLKSZ 512
+#define kTRACKSECTORS 13		// floppy_track loads a 6656 byte track as 13 sectors
 
+// How long a sector request or mount waits before sd_ack, in clk_sys cycles
+enum SimBlockDevice_Latency {
+	SimBlockDevice_Fixed,		// latencyCycles for every request
+	SimBlockDevice_Realistic,	// SD card like spread, writes slower, occasional long stalls
+	SimBlockDevice_Instant		// data flows on the next clock
+};
+
+// Where each drive is in a request
+enum SimBlockDevice_State {
+	SimBlockDevice_Idle,
+	SimBlockDevice_Waiting,		// request latency counting down
+	SimBlockDevice_Ready,		// sector staged, waiting for the sd_buff bus
+	SimBlockDevice_Transfer,	// owns the bus, sd_ack high
+	SimBlockDevice_Mounting		// img_mounted high for this drive
+};
+
+struct SimBlockDevice_Drive {
+	SimBlockDevice_State state;
+	bool write;
+	int delay;				// cycles left in Waiting/Mounting
+	int bytecnt;
+	uint32_t lba;
+	uint64_t requestCycle;	// when sd_rd/sd_wr was seen
+	uint8_t buffer[kBLKSZ];
+};
+
+// Per drive request counters; times are in clk_sys cycles
+struct SimBlockDevice_Stats {
+	std::string image;		// last image mounted, kept after it is closed
+	uint64_t reads;			// sectors
+	uint64_t writes;
+	uint64_t bytesRead;
+	uint64_t bytesWritten;
+	uint64_t seeks;			// requests not for the sector after the previous one
+	uint64_t cacheHits;		// reads served from a track already staged
+	uint64_t mounts;
+	SimHistogram ackLatency;	// request to sd_ack
+	SimHistogram spacing;		// request to the next request on the same drive
+	uint64_t lastRequest;
+	uint32_t lastLba;
+};
+
+// Each drive runs its own request: latency counts down independently, so
+// requests on several drives overlap, and only the byte transfer itself is
+// serialised because sd_buff_addr/dout/wr are shared by every drive.
+// Ready drives are granted the bus round-robin.  Mounts share img_size, so
+// one mount is in flight at a time, but they no longer hold up transfers.
 struct SimBlockDevice {
 public:
 
@@ -27,28 +80,85 @@ public:
 	SData* img_mounted;
 	CData* img_readonly;
 	QData* img_size;
+	CData* disk_busy;		// {cpu_wait_fdd, TRACK2_RAM_BUSY, TRACK1_RAM_BUSY}
 
-	int bytecnt;
         long int disk_size[kVDNUM];
-	bool reading;
-	bool writing;
-	int ack_delay;
-	int current_disk;
-	bool mountQueue[kVDNUM];
-	std::fstream disk[kVDNUM];
-
-	void BeforeEval(int cycles);
+	bool mountQueue[kVDNUM];	// img_mounted pulse owed to the core; size 0 is an eject
+	SimDiskImage disk[kVDNUM];
+	SimBlockDevice_Drive drive[kVDNUM];
+
+	// Drives not idle or with a mount queued; together with the sd_rd/sd_wr
+	// request bits this is all BeforeEval has to look at
+	uint32_t activeDrives;
+	int busOwner;		// drive transferring on sd_buff_*, or -1
+	int lastOwner;
+	int mountOwner;		// drive whose mount is on img_size, or -1
+
+	// Copy-on-write: applied to images mounted after it is set
+	SimDiskImage_Overlay overlayMode;
+	SimDiskImage_OverlayExit overlayExit;
+	std::string overlayDir;
+
+	// Disks of multi-disk software, swapped in with SelectDisk while the core
+	// keeps running; playlistPos is the entry last selected (kept over an
+	// eject so "next" carries on), or -1 after any other mount
+	std::vector<std::string> playlist[kVDNUM];
+	int playlistPos[kVDNUM];
+
+	// Floppy tracks staged on the host; capacity 0 disables it
+	SimTrackCache trackCache;
+
+	// Written sectors are flushed to the images by a worker thread; every
+	// image access on the simulation side holds imageLock while it runs
+	std::mutex imageLock;
+	SimWriteBack writeback;
+
+	SimBlockDevice_Latency latencyModel;
+	int latencyCycles;		// fixed model delay, and the realistic model's median
+
+	int stats_reads;		// sectors
+	int stats_writes;
+	uint64_t stats_latency;			// cycles with a request waiting for sd_ack
+	uint64_t stats_overlap;			// cycles with requests on more than one drive
+	uint64_t stats_trackBusy[2];	// cycles each floppy_track was reloading its track buffer
+	uint64_t stats_cpuWait;			// cycles the CPU was held by cpu_wait_fdd
+	SimBlockDevice_Stats stats_drive[kVDNUM];
+
+	// Log every request and mount to stdout (--trace disk)
+	bool trace;
+
+	void BeforeEval(uint64_t cycles);
 	void AfterEval(void);
 	//void QueueDownload(std::string file, int index);
 	//void QueueDownload(std::string file, int index, bool restart);
 	//bool HasQueue();
 	void MountDisk( std::string file, int index);
+	void EjectDisk(int index);
+	bool LoadPlaylist(int index, std::string list);	// comma separated, or a file with one image per line
+	void SelectDisk(int index, int position);		// wraps around the playlist
+	static bool LatencyFromName(std::string name, SimBlockDevice_Latency* model);
+	bool WriteStats(const char* file, int clockFrequency);	// JSON summary of the counters above
+	void Initialise();	// start the write-back thread
+	void CleanUp();		// flush, then close every image, committing or discarding overlays
 
 	SimBlockDevice(DebugConsole c);
 	~SimBlockDevice();
 
 
 private:
+	uint32_t random;
+	uint64_t now;		// cycle of the current BeforeEval
+	int RequestLatency(bool write);
+
+	int lastTrack[kVDNUM];
+	int headDirection[kVDNUM];
+	uint8_t* StageTrack(int drive, int track, bool prefetch);
+	bool ReadSector(int drive, int lba, uint8_t* buffer);
+	void DiskRead(int drive, uint32_t lba, uint8_t* buffer);
+	bool DiskWrite(int drive, uint32_t lba, const uint8_t* buffer);
+	void StartRequest(int drive, bool write);
+	void AbortRequest(int drive);
+	void TransferStep(int drive);
 	//std::queue<SimBus_DownloadChunk> downloadQueue;
 	//SimBus_DownloadChunk currentDownload;
 	//void SetDownload(std::string file, int index);
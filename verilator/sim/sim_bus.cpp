@@ -1,3 +1,4 @@
+#include <cstdio>
 #include <iostream>
 #include <queue>
 #include <string>
@@ -15,10 +16,6 @@
 
 static DebugConsole console;
 
-FILE* ioctl_file = NULL;
-int ioctl_next_addr = -1;
-int ioctl_last_index = -1;
-
 IData* ioctl_addr = NULL;
 CData* ioctl_index = NULL;
 CData* ioctl_wait = NULL;
@@ -42,70 +39,132 @@ bool SimBus::HasQueue() {
 	return downloadQueue.size() > 0;
 }
 
-int nextchar = 0;
+void SimBus::QueueUpload(std::string file, int index, uint32_t size) {
+	SimBus_UploadChunk chunk;
+	chunk.file = file;
+	chunk.index = index;
+	chunk.size = size;
+	uploadQueue.push(chunk);
+}
+
+// Read a whole file into data; false if it could not be opened
+static bool ReadWholeFile(std::string file, std::vector<uint8_t>& data) {
+	FILE* in = fopen(file.c_str(), "rb");
+	if (!in) { return false; }
+	fseek(in, 0, SEEK_END);
+	long size = ftell(in);
+	fseek(in, 0, SEEK_SET);
+	data.resize(size > 0 ? (size_t)size : 0);
+	size_t got = data.empty() ? 0 : fread(data.data(), 1, data.size(), in);
+	fclose(in);
+	data.resize(got);
+	return size >= 0;
+}
+
+// Called on each clk_sys rising edge before eval: one byte per clock at the
+// address it belongs to, with ioctl_wr, unless the core holds ioctl_wait.
 void SimBus::BeforeEval()
 {
-	// If no file is open and there is a download queued
-	if (!ioctl_file && downloadQueue.size() > 0) {
+	if (!downloading && downloadQueue.size() > 0) {
 
 		// Get chunk from queue
 		currentDownload = downloadQueue.front();
 		downloadQueue.pop();
 
 		// If last index differs from this one then reset the addresses
-		if (currentDownload.index != *ioctl_index) { ioctl_next_addr = -1; }
 		// if we want to restart the ioctl_addr then reset it
 		// leave it the same if we want to be able to load two roms sequentially
-		if (currentDownload.restart) { ioctl_next_addr = -1; }
-		// Set address and index
-		*ioctl_addr = ioctl_next_addr;
+		if (currentDownload.index != *ioctl_index || currentDownload.restart) { nextAddr = 0; }
 		*ioctl_index = currentDownload.index;
 
-		// Open file
-		ioctl_file = fopen(currentDownload.file.c_str(), "rb");
-		if (!ioctl_file) {
+		if (!ReadWholeFile(currentDownload.file, downloadData)) {
 			console.AddLog("Cannot open file for download %s\n", currentDownload.file.c_str());
 		}
 		else {
-			console.AddLog("Starting download: %s %d", currentDownload.file.c_str(), ioctl_next_addr, ioctl_next_addr);
+			console.AddLog("Starting download: %s (%d bytes) at %d", currentDownload.file.c_str(), (int)downloadData.size(), nextAddr);
+			downloading = true;
+			downloadPos = 0;
+			stats_file = currentDownload.file;
+			stats_bytes = 0;
+			stats_cycles = 0;
+			stats_waitCycles = 0;
+			stats_wallSeconds = 0;
+			downloadStart = std::chrono::steady_clock::now();
 		}
 	}
 
-	if (ioctl_file) {
-		//console.AddLog("ioctl_download addr %x  ioctl_wait %x", *ioctl_addr, *ioctl_wait);
-		if (*ioctl_wait == 0) {
-			*ioctl_download = 1;
-			*ioctl_wr = 1;
-			if (feof(ioctl_file)) {
-				fclose(ioctl_file);
-				ioctl_file = NULL;
-				*ioctl_download = 0;
-				*ioctl_wr = 0;
-				console.AddLog("ioctl_download complete %d", ioctl_next_addr);
-			}
-			if (ioctl_file) {
-				int curchar = fgetc(ioctl_file);
-				if (feof(ioctl_file) == 0) {
-					nextchar = curchar;
-					//console.AddLog("ioctl_download: dout %x \n", *ioctl_dout);
-					ioctl_next_addr++;
-				}
-			}
-		}
-	}
-	else {
+	if (!downloading) {
 		*ioctl_download = 0;
 		*ioctl_wr = 0;
+		if (uploading || uploadQueue.size() > 0) { UploadStep(); }
+		return;
+	}
+
+	*ioctl_download = 1;
+	stats_cycles++;
+	if (*ioctl_wait) {
+		// the core is busy with the last byte; present nothing new
+		*ioctl_wr = 0;
+		stats_waitCycles++;
+		return;
+	}
+	if (downloadPos < downloadData.size()) {
+		*ioctl_addr = nextAddr++;
+		*ioctl_dout = downloadData[downloadPos++];
+		*ioctl_wr = 1;
+		stats_bytes++;
+		return;
 	}
+
+	// every byte has been written
+	downloading = false;
+	*ioctl_download = 0;
+	*ioctl_wr = 0;
+	stats_wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - downloadStart).count();
+	console.AddLog("ioctl_download complete: %d bytes, %.0f KB per emulated s, %.0f KB per wall s", (int)stats_bytes, BytesPerEmulatedSecond() / 1024, BytesPerWallSecond() / 1024);
+	downloadData.clear();
+	downloadData.shrink_to_fit();
 }
 
-void SimBus::AfterEval()
+// One clock of an upload.  The core's memory is registered, so ioctl_din
+// now holds the byte for the address presented on the previous clock.
+void SimBus::UploadStep()
 {
-	*ioctl_addr = ioctl_next_addr;
-	*ioctl_dout = (unsigned char)nextchar;
-	if (ioctl_file) {
-		//	console.AddLog("ioctl_download %x wr %x dl %x\n", *ioctl_addr, *ioctl_wr, *ioctl_download);
+	if (!uploading) {
+		currentUpload = uploadQueue.front();
+		uploadQueue.pop();
+		*ioctl_index = currentUpload.index;
+		*ioctl_addr = 0;
+		*ioctl_upload = 1;
+		uploadData.clear();
+		uploadData.reserve(currentUpload.size);
+		uploadAddr = 1;
+		uploading = true;
+		console.AddLog("Starting upload: index %d, %u bytes to %s", currentUpload.index, currentUpload.size, currentUpload.file.c_str());
+		return;
+	}
+
+	if (*ioctl_wait) { return; }
+	uploadData.push_back(*ioctl_din);
+	if (uploadData.size() < currentUpload.size) {
+		*ioctl_addr = uploadAddr++;
+		return;
+	}
+
+	uploading = false;
+	*ioctl_upload = 0;
+	FILE* out = fopen(currentUpload.file.c_str(), "wb");
+	if (!out) {
+		console.AddLog("Cannot open file for upload %s", currentUpload.file.c_str());
+		return;
 	}
+	fwrite(uploadData.data(), 1, uploadData.size(), out);
+	fclose(out);
+	console.AddLog("ioctl_upload complete: %u bytes", (unsigned int)uploadData.size());
+}
+
+void SimBus::AfterEval()
+{
 }
 
 
@@ -119,6 +178,16 @@ SimBus::SimBus(DebugConsole c) {
 	ioctl_wr = NULL;
 	ioctl_dout = NULL;
 	ioctl_din = NULL;
+	clockFrequency = 0;
+	stats_bytes = 0;
+	stats_cycles = 0;
+	stats_waitCycles = 0;
+	stats_wallSeconds = 0;
+	downloadPos = 0;
+	downloading = false;
+	nextAddr = 0;
+	uploadAddr = 0;
+	uploading = false;
 }
 
 SimBus::~SimBus() {
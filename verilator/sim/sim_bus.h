@@ -1,5 +1,9 @@
 #pragma once
+#include <chrono>
+#include <cstdint>
 #include <queue>
+#include <string>
+#include <vector>
 //#include "verilated_heavy.h"
 #include "sim_console.h"
 
@@ -20,9 +24,7 @@ public:
 		index = -1;
 	}
 
-	SimBus_DownloadChunk(std::string file, int index) {
-		SimBus_DownloadChunk(file, index, false);
-	}
+	SimBus_DownloadChunk(std::string file, int index) : SimBus_DownloadChunk(file, index, false) {}
 	SimBus_DownloadChunk(std::string file, int index, bool restart) {
 		this->restart = restart;
 		this->file = std::string(file);
@@ -30,6 +32,14 @@ public:
 	}
 };
 
+// Memory read back from the core over ioctl_din into a file
+struct SimBus_UploadChunk {
+public:
+	std::string file;
+	int index;
+	uint32_t size;
+};
+
 struct SimBus {
 public:
 
@@ -42,11 +52,28 @@ public:
 	CData* ioctl_dout;
 	CData* ioctl_din;
 
+	// Download of the file in progress, or the last one: bytes, and clk_sys
+	// cycles from the first byte to the last including those held by ioctl_wait
+	int clockFrequency;		// clk_sys, for the emulated rate
+	std::string stats_file;
+	uint64_t stats_bytes;
+	uint64_t stats_cycles;
+	uint64_t stats_waitCycles;
+	double stats_wallSeconds;
+	double BytesPerEmulatedSecond() { return stats_cycles && clockFrequency ? stats_bytes * (double)clockFrequency / stats_cycles : 0.0; }
+	double BytesPerWallSecond() { return stats_wallSeconds > 0 ? stats_bytes / stats_wallSeconds : 0.0; }	// once complete
+	bool Downloading() { return downloading; }
+	size_t DownloadSize() { return downloadData.size(); }
+
 	void BeforeEval(void);
 	void AfterEval(void);
 	void QueueDownload(std::string file, int index);
 	void QueueDownload(std::string file, int index, bool restart);
 	bool HasQueue();
+	// Cycle accurate read back: one address per clock, ioctl_din sampled a
+	// clock later, written to file when all size bytes are in
+	void QueueUpload(std::string file, int index, uint32_t size);
+	bool Uploading() { return uploading; }
 
 	SimBus(DebugConsole c);
 	~SimBus();
@@ -55,4 +82,18 @@ private:
 	std::queue<SimBus_DownloadChunk> downloadQueue;
 	SimBus_DownloadChunk currentDownload;
 	void SetDownload(std::string file, int index);
+
+	// The whole file is read when its download starts; BeforeEval only indexes it
+	std::vector<uint8_t> downloadData;
+	size_t downloadPos;
+	bool downloading;
+	uint32_t nextAddr;
+	std::chrono::steady_clock::time_point downloadStart;
+
+	std::queue<SimBus_UploadChunk> uploadQueue;
+	SimBus_UploadChunk currentUpload;
+	std::vector<uint8_t> uploadData;
+	uint32_t uploadAddr;		// next address to present
+	bool uploading;
+	void UploadStep();
 };
@@ -0,0 +1,232 @@
+#include "sim_capture.h"
+#include "sim_png.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+SimCapture::SimCapture(int slots)
+{
+	slotCount = slots;
+	active = false;
+	stream = NULL;
+	stopping = false;
+	primed = false;
+	pending = false;
+	haveLast = false;
+	stats_captured = 0;
+	stats_repeated = 0;
+	stats_dropped = 0;
+}
+
+SimCapture::~SimCapture()
+{
+	Stop();
+}
+
+bool SimCapture::FormatFromName(std::string name, SimCapture_Format* format) {
+	std::string ext = name.substr(name.find_last_of('.') + 1);
+	std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+	if (ext == "y4m") { *format = SimCapture_Y4M; }
+	else if (ext == "raw" || ext == "rgba") { *format = SimCapture_Raw; }
+	else if (ext == "png") { *format = SimCapture_PNG; }
+	else { return false; }
+	return true;
+}
+
+// PNG file names: a path with one %d or %0Nd conversion is used as given,
+// anything else gets _%06d before its .png extension.  The result is the
+// snprintf format for Encode(), so no other conversion may get through.
+static bool PngPattern(const std::string& path, std::string* pattern) {
+	size_t percent = path.find('%');
+	if (percent == std::string::npos) {
+		std::string base = path;
+		if (base.size() > 4) {
+			std::string ext = base.substr(base.size() - 4);
+			std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+			if (ext == ".png") { base.erase(base.size() - 4); }
+		}
+		*pattern = base + "_%06d.png";
+		return true;
+	}
+	size_t i = percent + 1;
+	if (i < path.size() && path[i] == '0') {
+		i++;
+		while (i < path.size() && isdigit((unsigned char)path[i])) { i++; }
+	}
+	if (i >= path.size() || path[i] != 'd' || path.find('%', i) != std::string::npos) { return false; }
+	*pattern = path;
+	return true;
+}
+
+bool SimCapture::Start(std::string path, SimCapture_Format format, int width, int height, int fps) {
+	Stop();
+
+	if (format == SimCapture_PNG && !PngPattern(path, &pngPattern)) {
+		fprintf(stderr, "%s: PNG capture names take one %%d or %%0Nd and no other %%\n", path.c_str());
+		return false;
+	}
+
+	this->path = path;
+	this->format = format;
+	this->width = width;
+	this->height = height;
+	this->fps = fps;
+
+	if (format != SimCapture_PNG) {
+		stream = fopen(path.c_str(), "wb");
+		if (!stream) { return false; }
+		setvbuf(stream, NULL, _IOFBF, 1 << 20);
+		if (format == SimCapture_Y4M) {
+			fprintf(stream, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", width, height, fps);
+		}
+	}
+
+	slots.assign(slotCount, std::vector<uint32_t>((size_t)width * height));
+	freeSlots.clear();
+	for (int i = 0; i < slotCount; i++) { freeSlots.push_back(i); }
+	queue.clear();
+	last.assign((size_t)width * height, 0);
+	haveLast = false;
+	primed = false;
+	pending = false;
+	stats_captured = 0;
+	stats_repeated = 0;
+	stats_dropped = 0;
+
+	stopping = false;
+	active = true;
+	worker = std::thread(&SimCapture::Run, this);
+	return true;
+}
+
+void SimCapture::Stop() {
+	if (!active) { return; }
+
+	// The worker drains whatever is queued before exiting.  Set the flag under
+	// the lock so the worker can't test the predicate and miss the notify.
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+		wake.notify_one();
+	}
+	worker.join();
+	active = false;
+
+	if (stream) {
+		fclose(stream);
+		stream = NULL;
+	}
+	slots.clear();
+}
+
+void SimCapture::PushFrame(const uint32_t* pixels, int frame, bool changed) {
+	if (!active) { return; }
+
+	if (!changed && primed && !pending) {
+		stats_repeated++;
+		if (format == SimCapture_PNG) { return; }
+		std::lock_guard<std::mutex> guard(lock);
+		PushRepeat(frame);
+		return;
+	}
+
+	int slot;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (freeSlots.empty()) {
+			// Worker is behind: drop, but keep stream formats on the emulated timeline
+			stats_dropped++;
+			if (changed) { pending = true; }
+			if (format != SimCapture_PNG && primed) { PushRepeat(frame); }
+			return;
+		}
+		slot = freeSlots.back();
+		freeSlots.pop_back();
+	}
+
+	memcpy(slots[slot].data(), pixels, (size_t)width * height * sizeof(uint32_t));
+	primed = true;
+	pending = false;
+
+	std::lock_guard<std::mutex> guard(lock);
+	queue.push_back({ slot, frame });
+	wake.notify_one();
+}
+
+// Caller holds the lock.  Repeats need no slot, but the queue stays bounded.
+void SimCapture::PushRepeat(int frame) {
+	if (queue.size() >= (size_t)slotCount * 8) {
+		stats_dropped++;
+		return;
+	}
+	queue.push_back({ -1, frame });
+	wake.notify_one();
+}
+
+void SimCapture::Run() {
+	for (;;) {
+		Entry entry;
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			wake.wait(guard, [this] { return !queue.empty() || stopping; });
+			if (queue.empty()) { return; }
+			entry = queue.front();
+			queue.pop_front();
+		}
+
+		if (entry.slot >= 0) {
+			Encode(slots[entry.slot].data(), entry.frame);
+			// Keep the encoded frame for repeats and hand back the old buffer
+			std::swap(last, slots[entry.slot]);
+			haveLast = true;
+			std::lock_guard<std::mutex> guard(lock);
+			freeSlots.push_back(entry.slot);
+		}
+		else if (haveLast) {
+			Encode(last.data(), entry.frame);
+		}
+		stats_captured++;
+	}
+}
+
+void SimCapture::Encode(const uint32_t* pixels, int frame) {
+	size_t count = (size_t)width * height;
+
+	if (format == SimCapture_PNG) {
+		char name[1024];
+		snprintf(name, sizeof(name), pngPattern.c_str(), frame);
+		SimPngWrite(name, pixels, width, height);
+		return;
+	}
+
+	if (format == SimCapture_Raw) {
+		encodeBuffer.resize(count * 4);
+		for (size_t i = 0; i < count; i++) {
+			uint32_t p = pixels[i];
+			encodeBuffer[i * 4 + 0] = p & 0xFF;
+			encodeBuffer[i * 4 + 1] = (p >> 8) & 0xFF;
+			encodeBuffer[i * 4 + 2] = (p >> 16) & 0xFF;
+			encodeBuffer[i * 4 + 3] = (p >> 24) & 0xFF;
+		}
+		fwrite(encodeBuffer.data(), 1, encodeBuffer.size(), stream);
+		return;
+	}
+
+	// Y4M: planar 4:4:4, BT.601 studio range.  The conversion rounds, so this
+	// is not bit exact; raw and PNG captures are
+	encodeBuffer.resize(count * 3);
+	uint8_t* py = &encodeBuffer[0];
+	uint8_t* pu = &encodeBuffer[count];
+	uint8_t* pv = &encodeBuffer[count * 2];
+	for (size_t i = 0; i < count; i++) {
+		int r = pixels[i] & 0xFF;
+		int g = (pixels[i] >> 8) & 0xFF;
+		int b = (pixels[i] >> 16) & 0xFF;
+		py[i] = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+		pu[i] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+		pv[i] = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+	}
+	fputs("FRAME\n", stream);
+	fwrite(encodeBuffer.data(), 1, encodeBuffer.size(), stream);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum SimCapture_Format {
+	SimCapture_Y4M,		// YUV4MPEG2 4:4:4 stream (BT.601, one FRAME per emulated frame); lossy, colours are rounded through YUV
+	SimCapture_Raw,		// Concatenated RGBA frames, bit exact
+	SimCapture_PNG		// Numbered PNG files (one %d or %0Nd in the path, else name_%06d.png), bit exact, unchanged frames are skipped
+};
+
+// Background video capture.
+// PushFrame() copies a completed frame into one of a fixed number of slots and
+// returns; a worker thread encodes the slots in order.  When every slot is
+// busy the frame is dropped and counted rather than stalling the simulation.
+// Unchanged frames (same hash as the previous one) are not copied at all: the
+// stream formats repeat the last encoded frame, PNG sequences skip them.  After
+// a changed frame is dropped the next frame is copied whatever its hash, so
+// repeats never stand in for a frame that was never encoded.
+struct SimCapture {
+public:
+
+	std::atomic<int> stats_captured;	// frames written by the worker, repeats included
+	int stats_repeated;
+	int stats_dropped;
+
+	bool Start(std::string path, SimCapture_Format format, int width, int height, int fps);
+	void Stop();
+	bool IsActive() { return active; }
+	void PushFrame(const uint32_t* pixels, int frame, bool changed);
+	static bool FormatFromName(std::string name, SimCapture_Format* format);
+
+	SimCapture(int slots);
+	~SimCapture();
+
+private:
+	struct Entry {
+		int slot;	// -1 repeats the previous frame
+		int frame;
+	};
+
+	bool active;
+	SimCapture_Format format;
+	std::string path;
+	std::string pngPattern;		// checked snprintf format for PNG file names
+	int width;
+	int height;
+	int fps;
+	FILE* stream;
+
+	int slotCount;
+	std::vector<std::vector<uint32_t>> slots;
+	std::vector<int> freeSlots;
+	std::deque<Entry> queue;
+	bool primed;
+	bool pending;	// a changed frame was dropped; copy the next one regardless
+
+	// Worker side
+	std::vector<uint32_t> last;
+	bool haveLast;
+	std::vector<uint8_t> encodeBuffer;
+
+	std::mutex lock;
+	std::condition_variable wake;
+	std::atomic<bool> stopping;
+	std::thread worker;
+
+	void PushRepeat(int frame);
+	void Run();
+	void Encode(const uint32_t* pixels, int frame);
+};
@@ -0,0 +1,448 @@
+#include "sim_diskimage.h"
+#include "sim_nibble.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#ifdef WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Exclusive lock without waiting, released when the file is closed.  On
+// Windows a byte far past the end is locked so reads and writes of the data
+// are never blocked.
+#ifdef WIN32
+static bool TryLock(HANDLE handle) {
+	OVERLAPPED overlapped = {};
+	overlapped.OffsetHigh = 0x7FFFFFFF;
+	return LockFileEx(handle, LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY, 0, 1, 0, &overlapped) != 0;
+}
+static bool TryLock(FILE* file) { return TryLock((HANDLE)_get_osfhandle(_fileno(file))); }
+static int ProcessId() { return (int)GetCurrentProcessId(); }
+#else
+static bool TryLock(int fd) { return flock(fd, LOCK_EX | LOCK_NB) == 0; }
+static bool TryLock(FILE* file) { return TryLock(fileno(file)); }
+static int ProcessId() { return (int)getpid(); }
+#endif
+
+SimDiskImage::SimDiskImage()
+{
+	size = 0;
+	rawSize = 0;
+	readonly = false;
+	format = SimDiskImage_Raw;
+	stats_tracksEncoded = 0;
+	stats_tracksDecoded = 0;
+	overlay = SimDiskImage_Direct;
+	overlayExit = SimDiskImage_Discard;
+	data = NULL;
+	mode = SimDiskImage_Direct;
+	deltaFile = NULL;
+#ifdef WIN32
+	file = INVALID_HANDLE_VALUE;
+	mapping = NULL;
+#else
+	fd = -1;
+#endif
+}
+
+SimDiskImage::~SimDiskImage()
+{
+	Close();
+}
+
+bool SimDiskImage::Open(std::string file, bool readonly) {
+	Close();
+
+	// Overlays never write to the image, so it can always be shared read-only
+	mode = overlay;
+	path = file;
+	if (!Map(mode != SimDiskImage_Direct || readonly)) {
+		path = "";
+		return false;
+	}
+	if (mode != SimDiskImage_Direct) { this->readonly = readonly; }
+	if (mode == SimDiskImage_File && !OpenDelta()) {
+		Unmap();
+		path = "";
+		return false;
+	}
+#ifdef WIN32
+	bool locked = mode != SimDiskImage_Direct || this->readonly || TryLock((HANDLE)this->file);
+#else
+	bool locked = mode != SimDiskImage_Direct || this->readonly || TryLock(fd);
+#endif
+	if (!locked) {
+		// Another run writes this image directly; share it read-only
+		fprintf(stderr, "%s is in use by another run, opened read-only\n", file.c_str());
+		Unmap();
+		if (!Map(true)) {
+			path = "";
+			return false;
+		}
+	}
+
+	// The journal goes with whatever the writes land in: the locked image, or
+	// the delta file.  A memory delta has nothing durable to protect.
+	journalPath = "";
+	if (mode == SimDiskImage_File) { journalPath = deltaPath + ".journal"; }
+	else if (mode == SimDiskImage_Direct && !this->readonly) { journalPath = path + ".journal"; }
+
+	// Sector images of 35 to 40 tracks are served as nibble tracks
+	std::string extension = file.substr(file.find_last_of('.') + 1);
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+	format = SimDiskImage_Raw;
+	size = rawSize;
+	if (rawSize % kDSKTRACKSZ == 0 && rawSize >= 35 * kDSKTRACKSZ && rawSize <= 40 * kDSKTRACKSZ) {
+		if (extension == "dsk" || extension == "do") { format = SimDiskImage_DOSOrder; }
+		else if (extension == "po") { format = SimDiskImage_ProDOSOrder; }
+	}
+	if (extension == "woz" || (data && rawSize >= 4 && memcmp(data, "WOZ", 3) == 0)) {
+		if (!woz.Parse(data, rawSize)) {
+			fprintf(stderr, "%s: not a usable WOZ image\n", file.c_str());
+			Close();
+			return false;
+		}
+		format = SimDiskImage_WOZ;
+		this->readonly = true;
+	}
+	if (format != SimDiskImage_Raw) {
+		int count = format == SimDiskImage_WOZ ? woz.tracks : (int)(rawSize / kDSKTRACKSZ);
+		tracks.assign(count, std::vector<uint8_t>());
+		trackDirty.assign(count, 0);
+		stats_trackMicros.assign(count, 0.0f);
+		size = (uint64_t)count * kNIBTRACKSZ;
+	}
+	stats_tracksEncoded = 0;
+	stats_tracksDecoded = 0;
+	return true;
+}
+
+// Maps 'path'; a writable mapping falls back to read-only when the file can't be written
+bool SimDiskImage::Map(bool readonly) {
+#ifdef WIN32
+	HANDLE handle = CreateFileA(path.c_str(), readonly ? GENERIC_READ : GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (handle == INVALID_HANDLE_VALUE && !readonly) {
+		readonly = true;
+		handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	}
+	if (handle == INVALID_HANDLE_VALUE) { return false; }
+	LARGE_INTEGER length;
+	GetFileSizeEx(handle, &length);
+	rawSize = (uint64_t)length.QuadPart;
+	if (rawSize) {
+		HANDLE map = CreateFileMappingA(handle, NULL, readonly ? PAGE_READONLY : PAGE_READWRITE, 0, 0, NULL);
+		void* view = map ? MapViewOfFile(map, readonly ? FILE_MAP_READ : FILE_MAP_WRITE, 0, 0, 0) : NULL;
+		if (!view) {
+			if (map) { CloseHandle(map); }
+			CloseHandle(handle);
+			return false;
+		}
+		mapping = map;
+		data = (uint8_t*)view;
+	}
+	this->file = handle;
+#else
+	int handle = open(path.c_str(), readonly ? O_RDONLY : O_RDWR);
+	if (handle < 0 && !readonly) {
+		readonly = true;
+		handle = open(path.c_str(), O_RDONLY);
+	}
+	if (handle < 0) { return false; }
+	struct stat st;
+	if (fstat(handle, &st) != 0) {
+		close(handle);
+		return false;
+	}
+	rawSize = (uint64_t)st.st_size;
+	if (rawSize) {
+		void* view = mmap(NULL, rawSize, readonly ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, handle, 0);
+		if (view == MAP_FAILED) {
+			close(handle);
+			return false;
+		}
+		data = (uint8_t*)view;
+	}
+	fd = handle;
+#endif
+
+	this->readonly = readonly;
+	return true;
+}
+
+void SimDiskImage::Unmap() {
+#ifdef WIN32
+	if (data) { UnmapViewOfFile(data); }
+	if (mapping) { CloseHandle((HANDLE)mapping); }
+	if (file != INVALID_HANDLE_VALUE) { CloseHandle((HANDLE)file); }
+	mapping = NULL;
+	file = INVALID_HANDLE_VALUE;
+#else
+	if (data) { munmap(data, rawSize); }
+	if (fd >= 0) { close(fd); }
+	fd = -1;
+#endif
+	data = NULL;
+	rawSize = 0;
+	size = 0;
+}
+
+bool SimDiskImage::OpenDelta() {
+	std::string name = path;
+	if (deltaDir.length()) {
+		size_t slash = path.find_last_of("/\\");
+		name = deltaDir + "/" + (slash == std::string::npos ? path : path.substr(slash + 1));
+	}
+
+	// Only a kept delta has a fixed name, so the next run finds it; any other
+	// is private to this process
+	bool keep = overlayExit == SimDiskImage_Keep;
+	deltaPath = name + (keep ? "" : "." + std::to_string(ProcessId())) + ".delta";
+
+	deltaFile = fopen(deltaPath.c_str(), "r+b");
+	if (!deltaFile) { deltaFile = fopen(deltaPath.c_str(), "w+b"); }
+	if (!deltaFile) {
+		fprintf(stderr, "cannot open overlay %s\n", deltaPath.c_str());
+		return false;
+	}
+	if (!TryLock(deltaFile)) {
+		fprintf(stderr, "overlay %s is in use by another run\n", deltaPath.c_str());
+		fclose(deltaFile);
+		deltaFile = NULL;
+		return false;
+	}
+	// A private delta left by a crashed process with the same pid is stale
+	if (!keep) { Discard(); }
+
+	// Index the records of a kept delta; a torn record at the end is dropped
+	uint8_t record[4 + sector_size];
+	uint64_t offset = 0;
+	while (fread(record, 1, sizeof(record), deltaFile) == sizeof(record)) {
+		uint32_t lba = record[0] | (record[1] << 8) | (record[2] << 16) | ((uint32_t)record[3] << 24);
+		delta[lba] = offset + 4;
+		offset += sizeof(record);
+	}
+	fseek(deltaFile, (long)offset, SEEK_SET);
+	if (delta.size()) { printf("overlay %s: %d sectors\n", deltaPath.c_str(), (int)delta.size()); }
+	return true;
+}
+
+void SimDiskImage::Close() {
+	if (!IsOpen()) { return; }
+
+	FlushTracks();
+	tracks.clear();
+	trackDirty.clear();
+	format = SimDiskImage_Raw;
+	if (mode != SimDiskImage_Direct) {
+		if (overlayExit == SimDiskImage_Commit) { Commit(); }
+		else if (overlayExit == SimDiskImage_Discard) { Discard(); }
+		if (deltaFile) {
+			fclose(deltaFile);
+			deltaFile = NULL;
+			if (overlayExit != SimDiskImage_Keep) { remove(deltaPath.c_str()); }
+		}
+		delta.clear();
+		deltaData.clear();
+	}
+	Unmap();
+	path = "";
+	journalPath = "";
+}
+
+bool SimDiskImage::Read(uint32_t lba, uint8_t* buffer) {
+	if (format == SimDiskImage_Raw) { return ReadRaw(lba, buffer); }
+
+	// A nibble track is exactly 13 sectors, so a sector never spans two
+	uint64_t offset = (uint64_t)lba * sector_size;
+	if (offset >= size) {
+		memset(buffer, 0, sector_size);
+		return false;
+	}
+	memcpy(buffer, Track((int)(offset / kNIBTRACKSZ)) + offset % kNIBTRACKSZ, sector_size);
+	return true;
+}
+
+bool SimDiskImage::Write(uint32_t lba, const uint8_t* buffer) {
+	if (format == SimDiskImage_Raw) { return WriteRaw(lba, buffer); }
+
+	uint64_t offset = (uint64_t)lba * sector_size;
+	if (readonly || offset >= size) { return false; }
+	int track = (int)(offset / kNIBTRACKSZ);
+	memcpy(Track(track) + offset % kNIBTRACKSZ, buffer, sector_size);
+	trackDirty[track] = 1;
+	return true;
+}
+
+int SimDiskImage::Tracks() {
+	if (format != SimDiskImage_Raw) { return (int)tracks.size(); }
+	if (size >= 35 * kNIBTRACKSZ && size <= 40 * kNIBTRACKSZ && size % kNIBTRACKSZ == 0) { return (int)(size / kNIBTRACKSZ); }
+	return 0;
+}
+
+uint8_t* SimDiskImage::Track(int track) {
+	std::vector<uint8_t>& nibbles = tracks[track];
+	if (nibbles.empty()) {
+		auto start = std::chrono::steady_clock::now();
+		nibbles.resize(kNIBTRACKSZ);
+		if (format == SimDiskImage_WOZ) {
+			// floppy_track only addresses whole tracks
+			woz.DecodeTrack(track * 4, nibbles.data());
+		}
+		else {
+			uint8_t sectors[kDSKTRACKSZ];
+			for (int i = 0; i < kDSKTRACKSZ / sector_size; i++) { ReadRaw(track * (kDSKTRACKSZ / sector_size) + i, sectors + i * sector_size); }
+			SimNibbleEncodeTrack(sectors, track, format == SimDiskImage_ProDOSOrder, 254, nibbles.data());
+		}
+		stats_trackMicros[track] = std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - start).count();
+		stats_tracksEncoded++;
+	}
+	return nibbles.data();
+}
+
+void SimDiskImage::FlushTracks() {
+	for (size_t t = 0; t < tracks.size(); t++) {
+		if (!trackDirty[t]) { continue; }
+		trackDirty[t] = 0;
+
+		// Start from the stored sectors so any that no longer decode stay as they were
+		uint8_t sectors[kDSKTRACKSZ];
+		int first = (int)t * (kDSKTRACKSZ / sector_size);
+		for (int i = 0; i < kDSKTRACKSZ / sector_size; i++) { ReadRaw(first + i, sectors + i * sector_size); }
+		int decoded = SimNibbleDecodeTrack(tracks[t].data(), format == SimDiskImage_ProDOSOrder, sectors);
+		if (decoded != 0xFFFF) { fprintf(stderr, "%s track %d: sectors %04x not decodable, left unchanged\n", path.c_str(), (int)t, ~decoded & 0xFFFF); }
+		for (int i = 0; i < kDSKTRACKSZ / sector_size; i++) { WriteRaw(first + i, sectors + i * sector_size); }
+		stats_tracksDecoded++;
+	}
+}
+
+bool SimDiskImage::ReadRaw(uint32_t lba, uint8_t* buffer) {
+	if (!delta.empty()) {
+		auto found = delta.find(lba);
+		if (found != delta.end()) {
+			if (mode == SimDiskImage_Memory) { memcpy(buffer, &deltaData[found->second], sector_size); }
+			else {
+				fseek(deltaFile, (long)found->second, SEEK_SET);
+				if (fread(buffer, 1, sector_size, deltaFile) != (size_t)sector_size) { memset(buffer, 0, sector_size); }
+			}
+			return true;
+		}
+	}
+
+	uint64_t offset = (uint64_t)lba * sector_size;
+	if (!data || offset >= rawSize) {
+		memset(buffer, 0, sector_size);
+		return false;
+	}
+	uint64_t count = rawSize - offset < (uint64_t)sector_size ? rawSize - offset : sector_size;
+	memcpy(buffer, data + offset, count);
+	if (count < (uint64_t)sector_size) { memset(buffer + count, 0, sector_size - count); }
+	return true;
+}
+
+bool SimDiskImage::WriteRaw(uint32_t lba, const uint8_t* buffer) {
+	uint64_t offset = (uint64_t)lba * sector_size;
+	if (!data || readonly || offset >= rawSize) { return false; }
+
+	if (mode == SimDiskImage_Direct) {
+		uint64_t count = rawSize - offset < (uint64_t)sector_size ? rawSize - offset : sector_size;
+		memcpy(data + offset, buffer, count);
+		return true;
+	}
+
+	auto found = delta.find(lba);
+	if (mode == SimDiskImage_Memory) {
+		if (found == delta.end()) {
+			found = delta.emplace(lba, deltaData.size()).first;
+			deltaData.resize(deltaData.size() + sector_size);
+		}
+		memcpy(&deltaData[found->second], buffer, sector_size);
+		return true;
+	}
+
+	// File delta: rewrite the sector in place, or append a new record
+	if (found != delta.end()) {
+		fseek(deltaFile, (long)found->second, SEEK_SET);
+	}
+	else {
+		fseek(deltaFile, 0, SEEK_END);
+		uint8_t header[4] = { (uint8_t)lba, (uint8_t)(lba >> 8), (uint8_t)(lba >> 16), (uint8_t)(lba >> 24) };
+		fwrite(header, 1, 4, deltaFile);
+		delta[lba] = (uint64_t)ftell(deltaFile);
+	}
+	fwrite(buffer, 1, sector_size, deltaFile);
+	return true;
+}
+
+bool SimDiskImage::Commit() {
+	FlushTracks();
+	if (delta.empty()) { return true; }
+
+	FILE* image = fopen(path.c_str(), "r+b");
+	if (!image) {
+		fprintf(stderr, "cannot commit overlay: %s is not writable\n", path.c_str());
+		return false;
+	}
+	uint8_t sector[sector_size];
+	for (auto& entry : delta) {
+		uint64_t offset = (uint64_t)entry.first * sector_size;
+		ReadRaw(entry.first, sector);
+		fseek(image, (long)offset, SEEK_SET);
+		fwrite(sector, 1, rawSize - offset < (uint64_t)sector_size ? (size_t)(rawSize - offset) : sector_size, image);
+	}
+	fclose(image);
+	printf("overlay: %d sectors committed to %s\n", (int)delta.size(), path.c_str());
+	Discard();
+	return true;
+}
+
+void SimDiskImage::Discard() {
+	// Tracks are rebuilt from the image as it is without the delta
+	for (size_t t = 0; t < tracks.size(); t++) {
+		tracks[t].clear();
+		trackDirty[t] = 0;
+	}
+	delta.clear();
+	deltaData.clear();
+	if (deltaFile) {
+		// Truncate in place so the lock is kept
+		fflush(deltaFile);
+#ifdef WIN32
+		_chsize_s(_fileno(deltaFile), 0);
+#else
+		if (ftruncate(fileno(deltaFile), 0) != 0) { fprintf(stderr, "cannot truncate overlay %s\n", deltaPath.c_str()); }
+#endif
+		rewind(deltaFile);
+	}
+}
+
+void SimDiskImage::Sync() {
+	FlushTracks();
+	SyncData();
+}
+
+void SimDiskImage::SyncData() {
+	if (mode == SimDiskImage_File && deltaFile) {
+		fflush(deltaFile);
+#ifdef WIN32
+		_commit(_fileno(deltaFile));
+#else
+		fsync(fileno(deltaFile));
+#endif
+	}
+	if (!data || this->readonly || mode != SimDiskImage_Direct) { return; }
+#ifdef WIN32
+	FlushViewOfFile(data, 0);
+	FlushFileBuffers((HANDLE)file);
+#else
+	msync(data, rawSize, MS_SYNC);
+#endif
+}
@@ -0,0 +1,124 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "sim_woz.h"
+
+
+#ifndef _MSC_VER
+#else
+#define WIN32
+#endif
+
+// Where writes go
+enum SimDiskImage_Overlay {
+	SimDiskImage_Direct,	// into the image itself
+	SimDiskImage_Memory,	// into a sparse in-memory delta
+	SimDiskImage_File		// into a sparse delta file next to the image (or in deltaDir)
+};
+
+// What happens to an overlay delta when the image is closed
+enum SimDiskImage_OverlayExit {
+	SimDiskImage_Discard,
+	SimDiskImage_Commit,	// write the delta back into the image
+	SimDiskImage_Keep		// leave the delta file for the next run
+};
+
+// How the image is presented to the core
+enum SimDiskImage_Format {
+	SimDiskImage_Raw,			// as stored (.nib, .hdv, ...)
+	SimDiskImage_DOSOrder,		// .dsk/.do sector image, presented as .nib tracks
+	SimDiskImage_ProDOSOrder,	// .po sector image, presented as .nib tracks
+	SimDiskImage_WOZ			// .woz bitstream image, presented read-only as .nib tracks
+};
+
+// A disk image mapped into memory.
+// Sectors are copied straight out of (and into) the mapping, so a 512 byte
+// transfer is one memcpy and the page cache does the actual I/O.  Images
+// that cannot be opened for writing are mapped read-only instead.
+//
+// With an overlay the image is always mapped read-only and written sectors
+// are kept in a delta, so any number of simulations can share one image (and
+// one page cache copy of it).  A file delta is a sequence of records of a
+// 4 byte LBA followed by the sector.  It is named <image>.<pid>.delta, private
+// to the process, unless it is being kept: a kept delta is <image>.delta, is
+// picked up again by the next Open() and is locked while open, so a second
+// run using it is refused.  A writable image without an overlay is locked the
+// same way; another run gets it read-only.
+//
+// 140K sector images (.dsk/.do/.po) are presented as a .nib image, since
+// that is what floppy_track loads.  Each track is nibblized the first time
+// it is read and kept; written tracks are decoded back into sectors when the
+// image is synced or closed.  WOZ images go the same way, decoding the
+// bitstream of each track on first access.
+struct SimDiskImage {
+public:
+
+	static const int sector_size = 512;
+
+	std::string path;
+	uint64_t size;			// as presented to the core
+	bool readonly;
+	SimDiskImage_Format format;		// detected by Open()
+
+	SimDiskImage_Overlay overlay;		// takes effect on the next Open()
+	SimDiskImage_OverlayExit overlayExit;
+	std::string deltaDir;				// file deltas go here instead of next to the image
+	std::string deltaPath;
+	std::string journalPath;			// write-back journal for this image; empty for none
+
+	bool Open(std::string file, bool readonly);
+	void Close();		// applies overlayExit
+	int DeltaSectors() { return (int)delta.size(); }
+	// Nibble tracks in a floppy image (.nib, or any converted format); 0 otherwise
+	int Tracks();
+	bool Commit();		// write the delta into the image and empty it
+	void Discard();		// drop the delta (and delete its file)
+	bool IsOpen() { return path.length() > 0; }
+
+	// Sectors past the end of the image read as zeroes and ignore writes
+	bool Read(uint32_t lba, uint8_t* buffer);
+	bool Write(uint32_t lba, const uint8_t* buffer);
+	// Write back nibblized tracks and push written pages to the file
+	void Sync();
+	void FlushTracks();		// the first half: decode written tracks into sectors
+	void SyncData();		// the second half: make written sectors durable
+
+	int stats_tracksEncoded;		// tracks nibblized or WOZ decoded
+	int stats_tracksDecoded;		// tracks written back as sectors
+	std::vector<float> stats_trackMicros;	// time to build each track, 0 if untouched
+
+	SimDiskImage();
+	~SimDiskImage();
+
+private:
+	uint8_t* data;
+	uint64_t rawSize;
+	SimDiskImage_Overlay mode;			// overlay in effect for the open image
+
+	// Written sectors: offset into deltaData, or of the sector in deltaFile
+	std::unordered_map<uint32_t, uint64_t> delta;
+	std::vector<uint8_t> deltaData;
+	FILE* deltaFile;
+
+	SimWoz woz;
+
+	// Nibble tracks of a sector or WOZ image, built on first access
+	std::vector<std::vector<uint8_t>> tracks;
+	std::vector<uint8_t> trackDirty;
+	uint8_t* Track(int track);
+
+	bool ReadRaw(uint32_t lba, uint8_t* buffer);
+	bool WriteRaw(uint32_t lba, const uint8_t* buffer);
+	bool Map(bool readonly);
+	void Unmap();
+	bool OpenDelta();
+#ifdef WIN32
+	void* file;
+	void* mapping;
+#else
+	int fd;
+#endif
+};
@@ -0,0 +1,150 @@
+#include "sim_framebuffer.h"
+#include "sim_framehash.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+SimFramebuffer::SimFramebuffer(int width, int height, int rotate)
+{
+	output_width = width;
+	output_height = height;
+	output_size = output_width * output_height * 4;
+	output_rotate = rotate;
+	output_vflip = 0;
+	output_ptr = NULL;
+
+	count_pixel = 0;
+	count_line = 0;
+	count_frame = 0;
+	frame_ready = 1;
+	frame_hash = 0;
+	frame_changed = true;
+	dirty_rows = 0;
+	last_hblank = 0;
+	last_vblank = 0;
+	last_hsync = 0;
+	last_vsync = 0;
+
+	time_ms = 0;
+	old_time = 0;
+	stats_frameTime = 0;
+	stats_fps = 0.0;
+	stats_xMax = -1000;
+	stats_yMax = -1000;
+	stats_xMin = 1000;
+	stats_yMin = 1000;
+}
+
+SimFramebuffer::~SimFramebuffer()
+{
+	free(output_ptr);
+}
+
+void SimFramebuffer::Allocate() {
+	if (!output_ptr) {
+		output_ptr = (uint32_t*)malloc(output_size);
+	}
+	memset(output_ptr, 0xAA, output_size);
+	row_dirty.assign(output_height, 1);
+	dirty_rows = output_height;
+}
+
+void SimFramebuffer::ClearDirty() {
+	if (!dirty_rows) { return; }
+	memset(row_dirty.data(), 0, row_dirty.size());
+	dirty_rows = 0;
+}
+
+bool SimFramebuffer::Clock(bool hblank, bool vblank, bool hsync, bool vsync, uint32_t colour) {
+
+	bool de = !(hblank || vblank);
+	bool hb_falling = (!hblank && last_hblank);
+	bool frame_done = false;
+
+	if (!vblank) {
+		// Next line on end of hblank
+		if (hb_falling) {
+			// Increment line and reset pixel count
+			count_line++;
+			count_pixel = 0;
+		}
+		if (de) {
+			count_pixel++;
+		}
+	}
+
+	// Reset on falling vsync
+	if (last_vsync && !vsync) {
+		count_frame++;
+		count_line = 0;
+		frame_ready = 1;
+		frame_done = true;
+
+		uint64_t hash = SimFrameHash(output_ptr, output_size);
+		frame_changed = (hash != frame_hash) || count_frame == 1;
+		frame_hash = hash;
+
+		time_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		stats_frameTime = (float)(time_ms - old_time);
+		old_time = time_ms;
+		stats_fps = (float)(1000.0 / stats_frameTime);
+	}
+
+	// Only draw outside of blanks
+	if (de) {
+
+		int ox = count_pixel - 1;
+		int oy = count_line - 1;
+		int x = ox, xs = output_width, y = oy;
+
+		if (output_rotate == -1) {
+			// Rotate output by 90 degrees clockwise
+			y = output_height - ox;
+			xs = output_width;
+			x = oy;
+		}
+		if (output_rotate == 1) {
+			// Rotate output by 90 degrees clockwise
+			y = ox;
+			xs = output_width;
+			x = output_width - oy;
+		}
+
+		if (output_vflip) {
+			y = output_height - y;
+		}
+
+		// Clamp values to stop access violations on texture
+		if (x < 0) { x = 0; }
+		if (x > output_width - 1) { x = output_width - 1; }
+		if (y < 0) { y = 0; }
+		if (y > output_height - 1) { y = output_height - 1; }
+
+		// Generate texture address
+		uint32_t vga_addr = (y * xs) + x;
+
+		// Write pixel to texture, marking the row when it actually changes
+		if (output_ptr[vga_addr] != colour) {
+			output_ptr[vga_addr] = colour;
+			if (!row_dirty[y]) {
+				row_dirty[y] = 1;
+				dirty_rows++;
+			}
+		}
+
+	}
+
+	// Track bounds (debug)
+	if (count_pixel > stats_xMax) { stats_xMax = count_pixel; }
+	if (count_line > stats_yMax) { stats_yMax = count_line; }
+	if (count_pixel < stats_xMin) { stats_xMin = count_pixel; }
+	if (count_line < stats_yMin) { stats_yMin = count_line; }
+
+	last_hblank = hblank;
+	last_vblank = vblank;
+	last_hsync = hsync;
+	last_vsync = vsync;
+
+	return frame_done;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Backend-independent half of the video output: beam counters, the RGBA
+// framebuffer and frame statistics.  Presentation (window, GPU texture) lives
+// in SimVideo, which is built either against SDL/OpenGL, DirectX or the null
+// presenter used by headless builds.
+struct SimFramebuffer {
+public:
+
+	int output_width;
+	int output_height;
+	int output_rotate;
+	bool output_vflip;
+
+	uint32_t* output_ptr;
+	unsigned int output_size;
+
+	int count_pixel;
+	int count_line;
+	int count_frame;
+	bool frame_ready;
+
+	// Hash of the last completed frame, and whether it differs from the one before
+	uint64_t frame_hash;
+	bool frame_changed;
+
+	// Rows written with a different colour since the presenter last called
+	// ClearDirty(); pixel writes compare before storing, so a redraw of the
+	// same content leaves the row clean
+	std::vector<uint8_t> row_dirty;
+	int dirty_rows;
+
+	float stats_fps;
+	float stats_frameTime;
+	int stats_xMax;
+	int stats_xMin;
+	int stats_yMax;
+	int stats_yMin;
+
+	SimFramebuffer(int width, int height, int rotate);
+	~SimFramebuffer();
+	void Allocate();
+	void ClearDirty();
+	// Returns true on the clock that completes a frame (falling vsync)
+	bool Clock(bool hblank, bool vblank, bool hsync, bool vsync, uint32_t colour);
+
+private:
+	bool last_hblank;
+	bool last_vblank;
+	bool last_hsync;
+	bool last_vsync;
+
+	double time_ms;
+	double old_time;
+};
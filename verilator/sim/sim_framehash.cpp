@@ -0,0 +1,140 @@
+#include "sim_framehash.h"
+
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FRAMEHASH_SSE2 1
+#endif
+
+static const uint64_t PRIME32_1 = 0x9E3779B1U;
+static const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+
+static const int kStripeLen = 64;
+static const int kSecretSize = 192;
+static const int kSecretConsumeRate = 8;
+static const int kStripesPerBlock = (kSecretSize - kStripeLen) / kSecretConsumeRate;
+static const int kBlockLen = kStripeLen * kStripesPerBlock;
+
+struct FrameHashSecret {
+	alignas(16) uint8_t bytes[kSecretSize];
+
+	FrameHashSecret() {
+		// splitmix64 sequence, fixed seed so hashes are stable between runs
+		uint64_t x = 0x544B32303030ULL; // "TK2000"
+		for (int i = 0; i < kSecretSize; i += 8) {
+			x += 0x9E3779B97F4A7C15ULL;
+			uint64_t z = x;
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+			z ^= z >> 31;
+			memcpy(bytes + i, &z, 8);
+		}
+	}
+};
+
+static const FrameHashSecret secret;
+
+static inline uint64_t Read64(const uint8_t* p) {
+	uint64_t v;
+	memcpy(&v, p, 8);
+	return v;
+}
+
+static inline uint64_t Mul128Fold64(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+	__uint128_t r = (__uint128_t)a * b;
+	return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+	uint64_t lo_lo = (a & 0xFFFFFFFF) * (b & 0xFFFFFFFF);
+	uint64_t hi_lo = (a >> 32) * (b & 0xFFFFFFFF);
+	uint64_t lo_hi = (a & 0xFFFFFFFF) * (b >> 32);
+	uint64_t hi_hi = (a >> 32) * (b >> 32);
+	uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+	uint64_t upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+	uint64_t lower = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+	return lower ^ upper;
+#endif
+}
+
+static inline uint64_t Avalanche(uint64_t h) {
+	h ^= h >> 37;
+	h *= 0x165667919E3779F9ULL;
+	h ^= h >> 32;
+	return h;
+}
+
+static inline void Accumulate512(uint64_t* acc, const uint8_t* input, const uint8_t* key) {
+#ifdef FRAMEHASH_SSE2
+	__m128i* xacc = (__m128i*)acc;
+	for (int i = 0; i < kStripeLen / 16; i++) {
+		__m128i data_vec = _mm_loadu_si128((const __m128i*)(input + i * 16));
+		__m128i key_vec = _mm_loadu_si128((const __m128i*)(key + i * 16));
+		__m128i data_key = _mm_xor_si128(data_vec, key_vec);
+		__m128i data_key_hi = _mm_shuffle_epi32(data_key, _MM_SHUFFLE(0, 3, 0, 1));
+		__m128i product = _mm_mul_epu32(data_key, data_key_hi);
+		__m128i data_swap = _mm_shuffle_epi32(data_vec, _MM_SHUFFLE(1, 0, 3, 2));
+		__m128i sum = _mm_add_epi64(_mm_load_si128(xacc + i), data_swap);
+		_mm_store_si128(xacc + i, _mm_add_epi64(product, sum));
+	}
+#else
+	for (int i = 0; i < 8; i++) {
+		uint64_t data_val = Read64(input + i * 8);
+		uint64_t data_key = data_val ^ Read64(key + i * 8);
+		acc[i ^ 1] += data_val;
+		acc[i] += (data_key & 0xFFFFFFFF) * (data_key >> 32);
+	}
+#endif
+}
+
+static inline void Scramble(uint64_t* acc, const uint8_t* key) {
+	for (int i = 0; i < 8; i++) {
+		uint64_t a = acc[i];
+		a ^= a >> 47;
+		a ^= Read64(key + i * 8);
+		a *= PRIME32_1;
+		acc[i] = a;
+	}
+}
+
+uint64_t SimFrameHash(const void* data, size_t len) {
+	const uint8_t* input = (const uint8_t*)data;
+	const uint8_t* key = secret.bytes;
+
+	alignas(16) uint64_t acc[8] = {
+		PRIME32_1, PRIME64_1, PRIME64_2, PRIME64_3,
+		0x85EBCA77U, 0xC2B2AE3DU, 0x27D4EB2FU, PRIME32_1
+	};
+
+	// Short inputs are zero padded to a single stripe
+	uint8_t pad[kStripeLen];
+	if (len < (size_t)kStripeLen) {
+		memset(pad, 0, sizeof(pad));
+		if (len) { memcpy(pad, input, len); }
+		Accumulate512(acc, pad, key);
+	}
+	else {
+		size_t blocks = (len - 1) / kBlockLen;
+		for (size_t b = 0; b < blocks; b++) {
+			for (int s = 0; s < kStripesPerBlock; s++) {
+				Accumulate512(acc, input + b * kBlockLen + s * kStripeLen, key + s * kSecretConsumeRate);
+			}
+			Scramble(acc, key + kSecretSize - kStripeLen);
+		}
+
+		// Remaining whole stripes, then the last 64 bytes (may overlap)
+		size_t stripes = ((len - 1) - blocks * kBlockLen) / kStripeLen;
+		for (size_t s = 0; s < stripes; s++) {
+			Accumulate512(acc, input + blocks * kBlockLen + s * kStripeLen, key + s * kSecretConsumeRate);
+		}
+		Accumulate512(acc, input + len - kStripeLen, key + kSecretSize - kStripeLen - 7);
+	}
+
+	uint64_t result = len * PRIME64_1;
+	for (int i = 0; i < 4; i++) {
+		result += Mul128Fold64(acc[2 * i] ^ Read64(key + 11 + 16 * i), acc[2 * i + 1] ^ Read64(key + 11 + 16 * i + 8));
+	}
+	return Avalanche(result);
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Fast 64-bit hash for completed framebuffers.
+// XXH3-style long-input loop: 8 x 64-bit accumulators fed 64-byte stripes,
+// scrambled every 1 KB block.  Uses SSE2 when available, otherwise a scalar
+// loop producing identical results.  Not wire-compatible with xxHash.
+uint64_t SimFrameHash(const void* data, size_t len);
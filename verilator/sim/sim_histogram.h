@@ -0,0 +1,49 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+
+// Power-of-two bucketed histogram of cycle counts: bucket n holds values in
+// [2^(n-1), 2^n), bucket 0 holds zero.  Cheap enough to update per request.
+struct SimHistogram {
+public:
+
+	static const int buckets = 40;
+
+	uint64_t count[buckets];
+	uint64_t total;
+	uint64_t samples;
+	uint64_t min;
+	uint64_t max;
+
+	void Add(uint64_t value) {
+		int bucket = 0;
+		while (bucket < buckets - 1 && (value >> bucket) != 0) { bucket++; }
+		count[bucket]++;
+		total += value;
+		if (!samples || value < min) { min = value; }
+		if (value > max) { max = value; }
+		samples++;
+	}
+	double Mean() { return samples ? (double)total / samples : 0.0; }
+	// Lower bound of the bucket holding the given fraction of samples
+	uint64_t Percentile(double fraction) {
+		uint64_t target = (uint64_t)(samples * fraction), seen = 0;
+		for (int bucket = 0; bucket < buckets; bucket++) {
+			seen += count[bucket];
+			if (seen > target) { return bucket ? (uint64_t)1 << (bucket - 1) : 0; }
+		}
+		return max;
+	}
+	void Reset() {
+		for (int bucket = 0; bucket < buckets; bucket++) { count[bucket] = 0; }
+		total = samples = min = max = 0;
+	}
+	void WriteJson(FILE* file) {
+		fprintf(file, "{ \"samples\": %llu, \"min\": %llu, \"max\": %llu, \"mean\": %.1f, \"p50\": %llu, \"p99\": %llu, \"buckets\": [",
+			(unsigned long long)samples, (unsigned long long)min, (unsigned long long)max, Mean(), (unsigned long long)Percentile(0.5), (unsigned long long)Percentile(0.99));
+		for (int bucket = 0; bucket < buckets; bucket++) { fprintf(file, "%s%llu", bucket ? ", " : "", (unsigned long long)count[bucket]); }
+		fprintf(file, "] }");
+	}
+
+	SimHistogram() { Reset(); }
+};
@@ -5,7 +5,12 @@
 #include <stdlib.h>
 
 #ifndef _MSC_VER
+#ifndef SIM_HEADLESS
 #include <SDL2/SDL.h>
+#else
+#include <stdint.h>
+typedef uint8_t Uint8;
+#endif
 int m_keyboardStateCount;
 const Uint8* m_keyboardState;
 Uint8* m_keyboardState_last = NULL;
@@ -534,6 +539,12 @@ bool ReadKeyboard()
 		if ((result == DIERR_INPUTLOST) || (result == DIERR_NOTACQUIRED)) { m_keyboard->Acquire(); }
 		else { return false; }
 	}
+#elif defined(SIM_HEADLESS)
+	// No keyboard without SDL, report nothing pressed
+	static const Uint8 no_keys[256] = { 0 };
+	m_keyboardStateCount = 256;
+	m_keyboardState = no_keys;
+	if (!m_keyboardState_last) m_keyboardState_last = (Uint8*)calloc(m_keyboardStateCount, sizeof(Uint8));
 #else
 	m_keyboardState = SDL_GetKeyboardState(&m_keyboardStateCount);
 	if (!m_keyboardState_last) m_keyboardState_last = (Uint8*)calloc(m_keyboardStateCount, sizeof(Uint8));
@@ -620,6 +631,126 @@ void SimInput::CleanUp() {
 #endif
 }
 
+// US layout set 2 scancodes for printable ASCII from 0x20, bit 8 set when SHIFT is needed.
+// keyboard.sv translates shifted US symbols onto the TK2000 matrix.
+static const unsigned short ascii2ps2[] =
+{
+	0x029, // space
+	0x116, // !
+	0x152, // "
+	0x126, // #
+	0x125, // $
+	0x12e, // %
+	0x13d, // &
+	0x052, // '
+	0x146, // (
+	0x145, // )
+	0x13e, // *
+	0x155, // +
+	0x041, // ,
+	0x04e, // -
+	0x049, // .
+	0x04a, // /
+	0x045, // 0
+	0x016, // 1
+	0x01e, // 2
+	0x026, // 3
+	0x025, // 4
+	0x02e, // 5
+	0x036, // 6
+	0x03d, // 7
+	0x03e, // 8
+	0x046, // 9
+	0x14c, // :
+	0x04c, // ;
+	0x141, // <
+	0x055, // =
+	0x149, // >
+	0x14a, // ?
+	0x11e, // @
+	0x01c, // A
+	0x032, // B
+	0x021, // C
+	0x023, // D
+	0x024, // E
+	0x02b, // F
+	0x034, // G
+	0x033, // H
+	0x043, // I
+	0x03b, // J
+	0x042, // K
+	0x04b, // L
+	0x03a, // M
+	0x031, // N
+	0x044, // O
+	0x04d, // P
+	0x015, // Q
+	0x02d, // R
+	0x01b, // S
+	0x02c, // T
+	0x03c, // U
+	0x02a, // V
+	0x01d, // W
+	0x022, // X
+	0x035, // Y
+	0x01a, // Z
+	0x054, // [
+	0x05d, // backslash
+	0x05b, // ]
+	0x136, // ^
+	0x14e, // _
+	0x00e, // `
+	0x01c, // a
+	0x032, // b
+	0x021, // c
+	0x023, // d
+	0x024, // e
+	0x02b, // f
+	0x034, // g
+	0x033, // h
+	0x043, // i
+	0x03b, // j
+	0x042, // k
+	0x04b, // l
+	0x03a, // m
+	0x031, // n
+	0x044, // o
+	0x04d, // p
+	0x015, // q
+	0x02d, // r
+	0x01b, // s
+	0x02c, // t
+	0x03c, // u
+	0x02a, // v
+	0x01d, // w
+	0x022, // x
+	0x035, // y
+	0x01a, // z
+	0x154, // {
+	0x15d, // |
+	0x15b, // }
+	0x10e, // ~
+};
+
+void SimInput::TypeText(const std::string& text) {
+	for (unsigned char c : text) {
+		unsigned int mapped;
+		bool shift = false;
+		if (c == '\n' || c == '\r') { mapped = 0x5a; }
+		else if (c == '\b') { mapped = 0x66; }
+		else if (c >= 0x20 && c < 0x7f) {
+			mapped = ascii2ps2[c - 0x20] & 0xFF;
+			shift = ascii2ps2[c - 0x20] & 0x100;
+		}
+		else { continue; }
+
+		if (shift) { keyEvents.push(SimInput_PS2KeyEvent(0, true, false, 0x12)); }
+		keyEvents.push(SimInput_PS2KeyEvent(0, true, false, mapped));
+		keyEvents.push(SimInput_PS2KeyEvent(0, false, false, mapped));
+		if (shift) { keyEvents.push(SimInput_PS2KeyEvent(0, false, false, 0x12)); }
+	}
+}
+
 unsigned int ps2_key_temp;
 bool ps2_clock = 1;
 
@@ -6,7 +6,9 @@
 #pragma comment(lib, "dxguid.lib")
 #endif
 #include "verilated.h"
+#include "sim_console.h"
 #include <queue>
+#include <string>
 #include <vector>
 
 
@@ -59,6 +61,7 @@ public:
 	int Initialise();
 	void CleanUp();
 	void SetMapping(int index, int code);
+	void TypeText(const std::string& text);	// Queue key presses for scripted input
 	void BeforeEval(void);
 	SimInput(int count, DebugConsole c);
 	~SimInput();
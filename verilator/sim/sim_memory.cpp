@@ -0,0 +1,195 @@
+#include "sim_memory.h"
+
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+SimMemory::SimMemory()
+{
+	stats_loads = 0;
+	stats_loadBytes = 0;
+	stats_loadMicros = 0;
+	stats_dumps = 0;
+	stats_dumpMicros = 0;
+}
+
+void SimMemory::Add(std::string name, uint8_t* data, uint32_t size) {
+	SimMemory_Region region;
+	region.name = name;
+	region.data = data;
+	region.size = size;
+	regions.push_back(region);
+}
+
+SimMemory_Region* SimMemory::Find(std::string name) {
+	for (SimMemory_Region& region : regions) {
+		if (region.name == name) { return &region; }
+	}
+	return NULL;
+}
+
+bool SimMemory::ParseAddress(std::string text, uint32_t* address) {
+	int base = 10;
+	size_t start = 0;
+	if (text.compare(0, 1, "$") == 0) { base = 16; start = 1; }
+	else if (text.compare(0, 2, "0x") == 0 || text.compare(0, 2, "0X") == 0) { base = 16; start = 2; }
+	if (start >= text.size()) { return false; }
+	char* end;
+	unsigned long value = strtoul(text.c_str() + start, &end, base);
+	if (*end || value > 0xFFFFFFFFul) { return false; }
+	*address = (uint32_t)value;
+	return true;
+}
+
+bool SimMemory::Load(std::string name, std::string file, uint32_t address) {
+	SimMemory_Region* region = Find(name);
+	if (!region) {
+		fprintf(stderr, "no memory region %s\n", name.c_str());
+		return false;
+	}
+	FILE* in = fopen(file.c_str(), "rb");
+	if (!in) {
+		fprintf(stderr, "cannot open %s\n", file.c_str());
+		return false;
+	}
+	fseek(in, 0, SEEK_END);
+	long size = ftell(in);
+	fseek(in, 0, SEEK_SET);
+	if (size < 0 || address >= region->size || (uint64_t)address + size > region->size) {
+		fprintf(stderr, "%s: %ld bytes at $%04X don't fit in %s (%u bytes)\n", file.c_str(), size, address, name.c_str(), region->size);
+		fclose(in);
+		return false;
+	}
+
+	// Straight into the verilated array; the core sees it on its next read
+	auto start = std::chrono::steady_clock::now();
+	size_t got = fread(region->data + address, 1, (size_t)size, in);
+	fclose(in);
+	stats_loadMicros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+	stats_loadBytes = (uint32_t)got;
+	stats_loads++;
+	return got == (size_t)size;
+}
+
+// $readmemh subset: whitespace separated hex words, one per byte, with
+// @address to move the load point and // or /* */ comments.  srec_cat
+// --ascii_hex files (STX, $Aaddress, bytes, ETX, checksum), as produced by
+// ROMs/TK2000/convert.sh, read the same way.
+static bool ReadMemH(std::string file, std::vector<uint8_t>& image, uint32_t size) {
+	std::ifstream in(file);
+	if (!in) { return false; }
+	std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	uint32_t address = 0;
+	size_t i = 0;
+	while (i < text.size()) {
+		char c = text[i];
+		if (isspace((unsigned char)c) || c == '\x02' || c == ',') { i++; continue; }
+		if (c == '\x03') { break; }
+		if (text.compare(i, 2, "$A") == 0) {
+			char* end;
+			address = (uint32_t)strtoul(text.c_str() + i + 2, &end, 16);
+			i = end - text.c_str();
+			continue;
+		}
+		if (text.compare(i, 2, "//") == 0) { i = text.find('\n', i); continue; }
+		if (text.compare(i, 2, "/*") == 0) {
+			i = text.find("*/", i);
+			if (i != std::string::npos) { i += 2; }
+			continue;
+		}
+		bool at = c == '@';
+		size_t first = i + (at ? 1 : 0), end = first;
+		while (end < text.size() && isxdigit((unsigned char)text[end])) { end++; }
+		if (end == first) {
+			fprintf(stderr, "%s: unexpected '%c' at offset %zu\n", file.c_str(), text[first < text.size() ? first : i], first);
+			return false;
+		}
+		std::string word = text.substr(first, end - first);
+		uint32_t value = (uint32_t)strtoul(word.c_str(), NULL, 16);
+		if (at) { address = value; }
+		else {
+			if (address >= size) {
+				fprintf(stderr, "%s: data past the end at $%X\n", file.c_str(), address);
+				return false;
+			}
+			if (image.size() <= address) { image.resize(address + 1, 0); }
+			image[address++] = (uint8_t)value;
+		}
+		i = end;
+	}
+	return true;
+}
+
+bool SimMemory::LoadImage(std::string name, std::string file) {
+	SimMemory_Region* region = Find(name);
+	if (!region) {
+		fprintf(stderr, "no memory region %s\n", name.c_str());
+		return false;
+	}
+
+	std::vector<uint8_t> image;
+	std::string extension = file.substr(file.find_last_of('.') + 1);
+	for (char& c : extension) { c = (char)tolower((unsigned char)c); }
+	if (extension == "hex" || extension == "mem") {
+		if (!ReadMemH(file, image, region->size)) {
+			fprintf(stderr, "cannot read %s\n", file.c_str());
+			return false;
+		}
+	}
+	else {
+		FILE* in = fopen(file.c_str(), "rb");
+		if (!in) {
+			fprintf(stderr, "cannot open %s\n", file.c_str());
+			return false;
+		}
+		fseek(in, 0, SEEK_END);
+		long size = ftell(in);
+		fseek(in, 0, SEEK_SET);
+		if (size < 0 || size > (long)region->size) {
+			fprintf(stderr, "%s: %ld bytes is larger than %s (%u bytes)\n", file.c_str(), size, name.c_str(), region->size);
+			fclose(in);
+			return false;
+		}
+		image.resize((size_t)size);
+		image.resize(fread(image.data(), 1, image.size(), in));
+		fclose(in);
+	}
+	if (image.size() < region->size) {
+		fprintf(stderr, "%s: %u of %u bytes, the rest of %s is left as it was\n", file.c_str(), (unsigned int)image.size(), region->size, name.c_str());
+	}
+	memcpy(region->data, image.data(), image.size());
+	return !image.empty();
+}
+
+bool SimMemory::Dump(std::string name, std::string file) {
+	SimMemory_Region* region = Find(name);
+	if (!region) {
+		fprintf(stderr, "no memory region %s\n", name.c_str());
+		return false;
+	}
+	FILE* out = fopen(file.c_str(), "wb");
+	if (!out) {
+		fprintf(stderr, "cannot write %s\n", file.c_str());
+		return false;
+	}
+	auto start = std::chrono::steady_clock::now();
+	size_t put = fwrite(region->data, 1, region->size, out);
+	fclose(out);
+	stats_dumpMicros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+	stats_dumps++;
+	return put == region->size;
+}
+
+int SimMemory::DumpAll(std::string prefix, int frame) {
+	int written = 0;
+	for (SimMemory_Region& region : regions) {
+		std::string name = region.name;
+		for (char& c : name) { c = (char)tolower((unsigned char)c); }
+		std::string file = prefix + "_" + name + (frame >= 0 ? "_" + std::to_string(frame) : "") + ".bin";
+		if (Dump(region.name, file)) { written++; }
+	}
+	return written;
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A memory of the core, bound in place to its verilated array
+struct SimMemory_Region {
+	std::string name;
+	uint8_t* data;
+	uint32_t size;
+};
+
+// Host side access to the core's memories.  The arrays are read and written
+// directly between evals, so a program lands in RAM in one memcpy instead of
+// a byte per clock over ioctl.
+struct SimMemory {
+public:
+
+	std::vector<SimMemory_Region> regions;
+
+	int stats_loads;
+	uint32_t stats_loadBytes;		// last load
+	double stats_loadMicros;
+	int stats_dumps;
+	double stats_dumpMicros;		// last dump
+
+	void Add(std::string name, uint8_t* data, uint32_t size);
+	SimMemory_Region* Find(std::string name);
+	// Copy a raw binary to address; false if it can't be read or doesn't fit
+	bool Load(std::string region, std::string file, uint32_t address);
+	// Replace a region's contents from offset 0: a raw .bin, or a .hex/.mem
+	// in $readmemh form (hex bytes, @address lines, // comments)
+	bool LoadImage(std::string region, std::string file);
+	// Write the whole region, as it is between evals
+	bool Dump(std::string region, std::string file);
+	// Every region to <prefix>_<name>[_<frame>].bin; frame -1 leaves it out
+	int DumpAll(std::string prefix, int frame);
+	// $hex, 0xhex or decimal
+	static bool ParseAddress(std::string text, uint32_t* address);
+
+	SimMemory();
+};
@@ -0,0 +1,113 @@
+#include "sim_nibble.h"
+
+#include <cstring>
+
+// 6-bit value to disk byte
+static const uint8_t write_table[64] = {
+	0x96, 0x97, 0x9A, 0x9B, 0x9D, 0x9E, 0x9F, 0xA6, 0xA7, 0xAB, 0xAC, 0xAD, 0xAE, 0xAF, 0xB2, 0xB3,
+	0xB4, 0xB5, 0xB6, 0xB7, 0xB9, 0xBA, 0xBB, 0xBC, 0xBD, 0xBE, 0xBF, 0xCB, 0xCD, 0xCE, 0xCF, 0xD3,
+	0xD6, 0xD7, 0xD9, 0xDA, 0xDB, 0xDC, 0xDD, 0xDE, 0xDF, 0xE5, 0xE6, 0xE7, 0xE9, 0xEA, 0xEB, 0xEC,
+	0xED, 0xEE, 0xEF, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF9, 0xFA, 0xFB, 0xFC, 0xFD, 0xFE, 0xFF
+};
+
+// File sector held by each physical sector
+static const uint8_t dos_order[16] = { 0x0, 0x7, 0xE, 0x6, 0xD, 0x5, 0xC, 0x4, 0xB, 0x3, 0xA, 0x2, 0x9, 0x1, 0x8, 0xF };
+static const uint8_t prodos_order[16] = { 0x0, 0x8, 0x1, 0x9, 0x2, 0xA, 0x3, 0xB, 0x4, 0xC, 0x5, 0xD, 0x6, 0xE, 0x7, 0xF };
+
+// Low two bits, swapped, as the RWTS packs them
+static inline uint8_t Swap2(uint8_t v) { return ((v & 1) << 1) | ((v >> 1) & 1); }
+
+static inline void Put44(uint8_t*& out, uint8_t v) {
+	*out++ = (v >> 1) | 0xAA;
+	*out++ = v | 0xAA;
+}
+
+void SimNibbleEncodeTrack(const uint8_t* sectors, int track, bool prodosOrder, uint8_t volume, uint8_t* nibbles) {
+	const uint8_t* order = prodosOrder ? prodos_order : dos_order;
+	uint8_t* out = nibbles;
+	memset(nibbles, 0xFF, kNIBTRACKSZ);
+	out += 48;
+
+	for (int sector = 0; sector < 16; sector++) {
+		// Address field
+		*out++ = 0xD5; *out++ = 0xAA; *out++ = 0x96;
+		Put44(out, volume);
+		Put44(out, track);
+		Put44(out, sector);
+		Put44(out, volume ^ track ^ sector);
+		*out++ = 0xDE; *out++ = 0xAA; *out++ = 0xEB;
+		out += 6;
+
+		// Data field: 86 auxiliary values holding the low bit pairs, then
+		// the top six bits of each byte, each XORed with the one before
+		const uint8_t* data = sectors + order[sector] * 256;
+		uint8_t values[342];
+		for (int i = 0; i < 86; i++) {
+			uint8_t v = Swap2(data[i]) | (Swap2(data[i + 86]) << 2);
+			if (i + 172 < 256) { v |= Swap2(data[i + 172]) << 4; }
+			values[i] = v;
+		}
+		for (int i = 0; i < 256; i++) { values[86 + i] = data[i] >> 2; }
+
+		*out++ = 0xD5; *out++ = 0xAA; *out++ = 0xAD;
+		uint8_t previous = 0;
+		for (int i = 0; i < 342; i++) {
+			*out++ = write_table[values[i] ^ previous];
+			previous = values[i];
+		}
+		*out++ = write_table[previous];
+		*out++ = 0xDE; *out++ = 0xAA; *out++ = 0xEB;
+		out += 27;
+	}
+}
+
+int SimNibbleDecodeTrack(const uint8_t* nibbles, bool prodosOrder, uint8_t* sectors) {
+	static int8_t read_table[256];
+	static bool read_table_ready = false;
+	if (!read_table_ready) {
+		memset(read_table, -1, sizeof(read_table));
+		for (int i = 0; i < 64; i++) { read_table[write_table[i]] = i; }
+		read_table_ready = true;
+	}
+
+	const uint8_t* order = prodosOrder ? prodos_order : dos_order;
+	int decoded = 0;
+
+	// The track is circular: fields may wrap around the end of the buffer
+	auto at = [nibbles](int i) { return nibbles[i % kNIBTRACKSZ]; };
+
+	for (int pos = 0; pos < kNIBTRACKSZ; pos++) {
+		if (at(pos) != 0xD5 || at(pos + 1) != 0xAA || at(pos + 2) != 0x96) { continue; }
+
+		uint8_t field[4];
+		for (int i = 0; i < 4; i++) { field[i] = ((at(pos + 3 + i * 2) << 1) | 1) & at(pos + 4 + i * 2); }
+		if ((field[0] ^ field[1] ^ field[2]) != field[3] || field[2] > 15) { continue; }
+		int sector = field[2];
+
+		// Data prologue shortly after the address field
+		int data = -1;
+		for (int i = pos + 14; i < pos + 14 + 64; i++) {
+			if (at(i) == 0xD5 && at(i + 1) == 0xAA && at(i + 2) == 0xAD) { data = i + 3; break; }
+		}
+		if (data < 0) { continue; }
+
+		uint8_t values[342];
+		uint8_t previous = 0;
+		bool valid = true;
+		for (int i = 0; i < 342 && valid; i++) {
+			int v = read_table[at(data + i)];
+			if (v < 0) { valid = false; break; }
+			previous ^= v;
+			values[i] = previous;
+		}
+		if (!valid || read_table[at(data + 342)] != previous) { continue; }
+
+		uint8_t* out = sectors + order[sector] * 256;
+		for (int i = 0; i < 256; i++) {
+			out[i] = (values[86 + i] << 2) | Swap2((values[i % 86] >> ((i / 86) * 2)) & 3);
+		}
+		decoded |= 1 << sector;
+		pos = data + 342;
+	}
+	return decoded;
+}
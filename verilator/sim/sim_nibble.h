@@ -0,0 +1,18 @@
+#pragma once
+#include <cstdint>
+
+// Apple II 16-sector GCR tracks, as the Disk II controller and .nib files see them
+#define kNIBTRACKSZ 6656		// bytes per nibble track (13 * 512)
+#define kDSKTRACKSZ 4096		// 16 sectors of 256 bytes
+
+// Encode one track of a sector image into nibbles: 48 sync bytes, then per
+// sector an address field (volume, track, sector, 4-and-4), 6 sync bytes,
+// a 6-and-2 data field and 27 sync bytes, padded with sync to kNIBTRACKSZ.
+// 'sectors' is the track in file order; prodosOrder selects the .po sector
+// interleave instead of the DOS 3.3 one.
+void SimNibbleEncodeTrack(const uint8_t* sectors, int track, bool prodosOrder, uint8_t volume, uint8_t* nibbles);
+
+// Decode a nibble track back into 'sectors' (file order).  Sectors whose
+// fields cannot be found or fail their checksum are left untouched.
+// Returns a bit mask of the physical sectors decoded.
+int SimNibbleDecodeTrack(const uint8_t* nibbles, bool prodosOrder, uint8_t* sectors);
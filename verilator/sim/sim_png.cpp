@@ -0,0 +1,449 @@
+#include "sim_png.h"
+
+#include <cstdio>
+#include <cstring>
+
+// CRC32 / Adler32
+// ---------------
+
+struct CrcTable {
+	uint32_t entry[256];
+
+	CrcTable() {
+		for (uint32_t n = 0; n < 256; n++) {
+			uint32_t c = n;
+			for (int k = 0; k < 8; k++) { c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1; }
+			entry[n] = c;
+		}
+	}
+};
+
+static const CrcTable crc_table;
+
+static uint32_t Crc32(uint32_t crc, const uint8_t* data, size_t len) {
+	crc = ~crc;
+	for (size_t i = 0; i < len; i++) { crc = crc_table.entry[(crc ^ data[i]) & 0xFF] ^ (crc >> 8); }
+	return ~crc;
+}
+
+static uint32_t Adler32(const uint8_t* data, size_t len) {
+	uint32_t a = 1, b = 0;
+	while (len > 0) {
+		size_t n = len < 5552 ? len : 5552;
+		len -= n;
+		while (n--) { a += *data++; b += a; }
+		a %= 65521;
+		b %= 65521;
+	}
+	return (b << 16) | a;
+}
+
+// Deflate tables (RFC 1951)
+// -------------------------
+
+static const uint16_t len_base[29] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258 };
+static const uint8_t len_extra[29] = { 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0 };
+static const uint16_t dist_base[30] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577 };
+static const uint8_t dist_extra[30] = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+
+// Deflate encoder
+// ---------------
+
+struct BitWriter {
+	std::vector<uint8_t>& out;
+	uint32_t bits = 0;
+	int count = 0;
+
+	BitWriter(std::vector<uint8_t>& o) : out(o) {}
+
+	// LSB-first value, as used for extra bits and block headers
+	void Put(uint32_t value, int n) {
+		bits |= value << count;
+		count += n;
+		while (count >= 8) {
+			out.push_back((uint8_t)bits);
+			bits >>= 8;
+			count -= 8;
+		}
+	}
+
+	// Huffman codes are stored MSB-first
+	void PutCode(uint32_t code, int n) {
+		uint32_t rev = 0;
+		for (int i = 0; i < n; i++) { rev = (rev << 1) | ((code >> i) & 1); }
+		Put(rev, n);
+	}
+
+	void Flush() {
+		if (count > 0) { out.push_back((uint8_t)bits); }
+		bits = 0;
+		count = 0;
+	}
+};
+
+static void PutLiteral(BitWriter& bw, int lit) {
+	if (lit < 144) { bw.PutCode(0x30 + lit, 8); }
+	else if (lit < 256) { bw.PutCode(0x190 + (lit - 144), 9); }
+	else if (lit < 280) { bw.PutCode(lit - 256, 7); }
+	else { bw.PutCode(0xC0 + (lit - 280), 8); }
+}
+
+static void PutMatch(BitWriter& bw, int length, int distance) {
+	int lc = 28;
+	while (len_base[lc] > length) { lc--; }
+	PutLiteral(bw, 257 + lc);
+	if (len_extra[lc]) { bw.Put(length - len_base[lc], len_extra[lc]); }
+
+	int dc = 29;
+	while (dist_base[dc] > distance) { dc--; }
+	bw.PutCode(dc, 5);
+	if (dist_extra[dc]) { bw.Put(distance - dist_base[dc], dist_extra[dc]); }
+}
+
+// Single fixed-Huffman block, greedy matching against the most recent
+// occurrence of each 3-byte hash.  Emulator frames are mostly flat colour
+// and repeated rows, so this gets most of the way to zlib -1.
+static void Deflate(const uint8_t* data, size_t len, std::vector<uint8_t>& out) {
+	const int hash_bits = 15;
+	const size_t window = 32768;
+	std::vector<int32_t> head((size_t)1 << hash_bits, -1);
+
+	BitWriter bw(out);
+	bw.Put(1, 1);	// BFINAL
+	bw.Put(1, 2);	// BTYPE = fixed Huffman
+
+	size_t pos = 0;
+	while (pos < len) {
+		int best_len = 0;
+		size_t best_dist = 0;
+		if (pos + 3 <= len) {
+			uint32_t h = ((data[pos] << 16) | (data[pos + 1] << 8) | data[pos + 2]) * 2654435761U >> (32 - hash_bits);
+			int32_t cand = head[h];
+			head[h] = (int32_t)pos;
+			if (cand >= 0 && pos - cand <= window) {
+				size_t max_len = len - pos < 258 ? len - pos : 258;
+				size_t l = 0;
+				while (l < max_len && data[cand + l] == data[pos + l]) { l++; }
+				if (l >= 3) {
+					best_len = (int)l;
+					best_dist = pos - cand;
+				}
+			}
+		}
+		if (best_len) {
+			PutMatch(bw, best_len, (int)best_dist);
+			// Keep the hash table warm across the match
+			for (size_t i = pos + 1; i < pos + best_len && i + 3 <= len; i++) {
+				uint32_t h = ((data[i] << 16) | (data[i + 1] << 8) | data[i + 2]) * 2654435761U >> (32 - hash_bits);
+				head[h] = (int32_t)i;
+			}
+			pos += best_len;
+		}
+		else {
+			PutLiteral(bw, data[pos]);
+			pos++;
+		}
+	}
+	PutLiteral(bw, 256);
+	bw.Flush();
+}
+
+// PNG writer
+// ----------
+
+static void PutBE32(std::vector<uint8_t>& out, uint32_t v) {
+	out.push_back(v >> 24);
+	out.push_back(v >> 16);
+	out.push_back(v >> 8);
+	out.push_back(v);
+}
+
+static void PutChunk(std::vector<uint8_t>& out, const char* type, const std::vector<uint8_t>& data) {
+	PutBE32(out, (uint32_t)data.size());
+	size_t start = out.size();
+	out.insert(out.end(), type, type + 4);
+	out.insert(out.end(), data.begin(), data.end());
+	PutBE32(out, Crc32(0, &out[start], out.size() - start));
+}
+
+bool SimPngWrite(const char* file, const uint32_t* pixels, int width, int height) {
+	// Filter type 0 rows of RGBA bytes
+	size_t stride = (size_t)width * 4 + 1;
+	std::vector<uint8_t> raw(stride * height);
+	for (int y = 0; y < height; y++) {
+		uint8_t* row = &raw[y * stride];
+		row[0] = 0;
+		for (int x = 0; x < width; x++) {
+			uint32_t p = pixels[y * width + x];
+			row[1 + x * 4 + 0] = p & 0xFF;
+			row[1 + x * 4 + 1] = (p >> 8) & 0xFF;
+			row[1 + x * 4 + 2] = (p >> 16) & 0xFF;
+			row[1 + x * 4 + 3] = (p >> 24) & 0xFF;
+		}
+	}
+
+	std::vector<uint8_t> ihdr;
+	PutBE32(ihdr, width);
+	PutBE32(ihdr, height);
+	ihdr.push_back(8);	// bit depth
+	ihdr.push_back(6);	// RGBA
+	ihdr.push_back(0);
+	ihdr.push_back(0);
+	ihdr.push_back(0);
+
+	std::vector<uint8_t> idat;
+	idat.push_back(0x78);
+	idat.push_back(0x01);
+	Deflate(raw.data(), raw.size(), idat);
+	PutBE32(idat, Adler32(raw.data(), raw.size()));
+
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	std::vector<uint8_t> png(signature, signature + 8);
+	PutChunk(png, "IHDR", ihdr);
+	PutChunk(png, "IDAT", idat);
+	PutChunk(png, "IEND", std::vector<uint8_t>());
+
+	FILE* f = fopen(file, "wb");
+	if (!f) { return false; }
+	bool ok = fwrite(png.data(), 1, png.size(), f) == png.size();
+	ok = (fclose(f) == 0) && ok;
+	return ok;
+}
+
+// Inflate (after Mark Adler's puff.c)
+// -----------------------------------
+
+struct Huffman {
+	uint16_t counts[16];
+	uint16_t symbols[320];
+};
+
+struct BitReader {
+	const uint8_t* data;
+	size_t len;
+	size_t pos = 0;
+	uint32_t bits = 0;
+	int count = 0;
+	bool overrun = false;
+
+	BitReader(const uint8_t* d, size_t l) : data(d), len(l) {}
+
+	int Get(int n) {
+		uint32_t v = bits;
+		while (count < n) {
+			if (pos >= len) { overrun = true; return 0; }
+			v |= (uint32_t)data[pos++] << count;
+			count += 8;
+		}
+		bits = v >> n;
+		count -= n;
+		return (int)(v & ((1UL << n) - 1));
+	}
+
+	int Decode(const Huffman& h) {
+		int code = 0, first = 0, index = 0;
+		for (int len = 1; len < 16; len++) {
+			code |= Get(1);
+			int count = h.counts[len];
+			if (code - count < first) { return h.symbols[index + (code - first)]; }
+			index += count;
+			first += count;
+			first <<= 1;
+			code <<= 1;
+			if (overrun) { break; }
+		}
+		return -1;
+	}
+};
+
+static void BuildHuffman(Huffman& h, const uint8_t* lengths, int n) {
+	uint16_t offs[16];
+	memset(h.counts, 0, sizeof(h.counts));
+	for (int s = 0; s < n; s++) { h.counts[lengths[s]]++; }
+	h.counts[0] = 0;
+	offs[1] = 0;
+	for (int len = 1; len < 15; len++) { offs[len + 1] = offs[len] + h.counts[len]; }
+	for (int s = 0; s < n; s++) {
+		if (lengths[s]) { h.symbols[offs[lengths[s]]++] = s; }
+	}
+}
+
+static bool InflateCodes(BitReader& br, std::vector<uint8_t>& out, const Huffman& lencode, const Huffman& distcode) {
+	for (;;) {
+		int sym = br.Decode(lencode);
+		if (sym < 0 || br.overrun) { return false; }
+		if (sym < 256) { out.push_back((uint8_t)sym); continue; }
+		if (sym == 256) { return true; }
+		sym -= 257;
+		if (sym >= 29) { return false; }
+		int length = len_base[sym] + br.Get(len_extra[sym]);
+		int dsym = br.Decode(distcode);
+		if (dsym < 0 || dsym >= 30) { return false; }
+		size_t distance = dist_base[dsym] + br.Get(dist_extra[dsym]);
+		if (distance > out.size()) { return false; }
+		size_t from = out.size() - distance;
+		for (int i = 0; i < length; i++) { out.push_back(out[from + i]); }
+	}
+}
+
+static bool Inflate(const uint8_t* data, size_t len, std::vector<uint8_t>& out) {
+	BitReader br(data, len);
+	int last;
+	do {
+		last = br.Get(1);
+		int type = br.Get(2);
+		if (type == 0) {
+			// Stored block: byte aligned LEN / NLEN
+			br.bits = 0;
+			br.count = 0;
+			if (br.pos + 4 > len) { return false; }
+			unsigned n = data[br.pos] | (data[br.pos + 1] << 8);
+			br.pos += 4;
+			if (br.pos + n > len) { return false; }
+			out.insert(out.end(), data + br.pos, data + br.pos + n);
+			br.pos += n;
+		}
+		else if (type == 1) {
+			static Huffman fixed_len, fixed_dist;
+			static bool fixed_ready = false;
+			if (!fixed_ready) {
+				uint8_t lengths[288];
+				int s = 0;
+				for (; s < 144; s++) { lengths[s] = 8; }
+				for (; s < 256; s++) { lengths[s] = 9; }
+				for (; s < 280; s++) { lengths[s] = 7; }
+				for (; s < 288; s++) { lengths[s] = 8; }
+				BuildHuffman(fixed_len, lengths, 288);
+				for (s = 0; s < 30; s++) { lengths[s] = 5; }
+				BuildHuffman(fixed_dist, lengths, 30);
+				fixed_ready = true;
+			}
+			if (!InflateCodes(br, out, fixed_len, fixed_dist)) { return false; }
+		}
+		else if (type == 2) {
+			static const uint8_t order[19] = { 16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15 };
+			int nlen = br.Get(5) + 257;
+			int ndist = br.Get(5) + 1;
+			int ncode = br.Get(4) + 4;
+			if (nlen > 286 || ndist > 30) { return false; }
+			uint8_t lengths[320] = { 0 };
+			for (int i = 0; i < ncode; i++) { lengths[order[i]] = br.Get(3); }
+			Huffman lencode, distcode;
+			BuildHuffman(lencode, lengths, 19);
+			int index = 0;
+			while (index < nlen + ndist) {
+				int sym = br.Decode(lencode);
+				if (sym < 0 || br.overrun) { return false; }
+				if (sym < 16) { lengths[index++] = sym; continue; }
+				int repeat_len = 0, repeat;
+				if (sym == 16) {
+					if (index == 0) { return false; }
+					repeat_len = lengths[index - 1];
+					repeat = 3 + br.Get(2);
+				}
+				else if (sym == 17) { repeat = 3 + br.Get(3); }
+				else { repeat = 11 + br.Get(7); }
+				if (index + repeat > nlen + ndist) { return false; }
+				while (repeat--) { lengths[index++] = repeat_len; }
+			}
+			BuildHuffman(lencode, lengths, nlen);
+			BuildHuffman(distcode, lengths + nlen, ndist);
+			if (!InflateCodes(br, out, lencode, distcode)) { return false; }
+		}
+		else {
+			return false;
+		}
+		if (br.overrun) { return false; }
+	} while (!last);
+	return true;
+}
+
+// PNG reader
+// ----------
+
+static uint32_t GetBE32(const uint8_t* p) {
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static int Paeth(int a, int b, int c) {
+	int p = a + b - c;
+	int pa = p > a ? p - a : a - p;
+	int pb = p > b ? p - b : b - p;
+	int pc = p > c ? p - c : c - p;
+	if (pa <= pb && pa <= pc) { return a; }
+	return pb <= pc ? b : c;
+}
+
+bool SimPngRead(const char* file, std::vector<uint32_t>& pixels, int* width, int* height) {
+	FILE* f = fopen(file, "rb");
+	if (!f) { return false; }
+	std::vector<uint8_t> png;
+	uint8_t buf[65536];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0) { png.insert(png.end(), buf, buf + n); }
+	fclose(f);
+
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	if (png.size() < 8 || memcmp(png.data(), signature, 8)) { return false; }
+
+	int w = 0, h = 0, channels = 0;
+	std::vector<uint8_t> idat;
+	size_t pos = 8;
+	while (pos + 12 <= png.size()) {
+		uint32_t len = GetBE32(&png[pos]);
+		if (pos + 12 + len > png.size()) { return false; }
+		const uint8_t* type = &png[pos + 4];
+		const uint8_t* body = &png[pos + 8];
+		if (!memcmp(type, "IHDR", 4)) {
+			w = GetBE32(body);
+			h = GetBE32(body + 4);
+			if (body[8] != 8 || body[12] != 0) { return false; }	// 8-bit, no interlace
+			if (body[9] == 2) { channels = 3; }
+			else if (body[9] == 6) { channels = 4; }
+			else { return false; }
+		}
+		else if (!memcmp(type, "IDAT", 4)) {
+			idat.insert(idat.end(), body, body + len);
+		}
+		else if (!memcmp(type, "IEND", 4)) {
+			break;
+		}
+		pos += 12 + len;
+	}
+	if (!channels || idat.size() < 2) { return false; }
+
+	std::vector<uint8_t> raw;
+	if (!Inflate(idat.data() + 2, idat.size() - 2, raw)) { return false; }
+	size_t stride = (size_t)w * channels;
+	if (raw.size() < (stride + 1) * h) { return false; }
+
+	// Undo the per-row filters in place
+	std::vector<uint8_t> prior(stride, 0);
+	pixels.resize((size_t)w * h);
+	for (int y = 0; y < h; y++) {
+		uint8_t filter = raw[y * (stride + 1)];
+		uint8_t* row = &raw[y * (stride + 1) + 1];
+		for (size_t i = 0; i < stride; i++) {
+			int a = i >= (size_t)channels ? row[i - channels] : 0;
+			int b = prior[i];
+			int c = i >= (size_t)channels ? prior[i - channels] : 0;
+			switch (filter) {
+			case 1: row[i] += a; break;
+			case 2: row[i] += b; break;
+			case 3: row[i] += (a + b) / 2; break;
+			case 4: row[i] += Paeth(a, b, c); break;
+			default: break;
+			}
+		}
+		for (int x = 0; x < w; x++) {
+			const uint8_t* p = row + x * channels;
+			uint32_t alpha = channels == 4 ? p[3] : 0xFF;
+			pixels[y * w + x] = p[0] | (p[1] << 8) | (p[2] << 16) | (alpha << 24);
+		}
+		memcpy(prior.data(), row, stride);
+	}
+
+	*width = w;
+	*height = h;
+	return true;
+}
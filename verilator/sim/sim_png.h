@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Minimal dependency-free PNG support for frame capture and golden images.
+// Pixels are 0xAABBGGRR words, the layout SimFramebuffer writes.
+
+// Write an 8-bit RGBA PNG (fixed-Huffman deflate with a greedy LZ77 matcher)
+bool SimPngWrite(const char* file, const uint32_t* pixels, int width, int height);
+
+// Read an 8-bit RGB or RGBA, non-interlaced PNG (any filter, any deflate block type)
+bool SimPngRead(const char* file, std::vector<uint32_t>& pixels, int* width, int* height);
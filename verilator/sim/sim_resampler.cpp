@@ -0,0 +1,210 @@
+#include "sim_resampler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RESAMPLER_SSE2 1
+#endif
+
+static const double pi = 3.14159265358979323846;
+
+// Zeroth order modified Bessel function, for the Kaiser window
+static double BesselI0(double x) {
+	double sum = 1.0, term = 1.0;
+	for (int k = 1; k < 50; k++) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+		if (term < sum * 1e-12) { break; }
+	}
+	return sum;
+}
+
+SimDecimator::SimDecimator()
+{
+	taps = 0;
+	historyPos = 0;
+	cicCount = 0;
+	cicScale = 0;
+	position = 0;
+	stepNominal = step = 0;
+	now = 0;
+	memset(integrator, 0, sizeof(integrator));
+	memset(comb, 0, sizeof(comb));
+}
+
+void SimDecimator::Configure(int inputRate, int outputRate) {
+	double cicRate = (double)inputRate / cic_decimation;
+
+	// Kaiser design for 80 dB stopband: passband to 0.42 fs_out, stop at 0.5 fs_out
+	const double attenuation = 80.0;
+	double pass = 0.42 * outputRate / cicRate;		// cycles per CIC sample
+	double stop = 0.5 * outputRate / cicRate;
+	double beta = 0.1102 * (attenuation - 8.7);
+	int length = (int)ceil((attenuation - 8.0) / (2.285 * 2.0 * pi * (stop - pass)));
+	taps = (length + 3) & ~3;
+
+	// Prototype at fir_phases times the CIC rate, cut off midway through the transition
+	int protoLength = taps * fir_phases;
+	double cutoff = (pass + stop) * 0.5 / fir_phases;
+	double centre = (protoLength - 1) * 0.5;
+	std::vector<double> proto(protoLength);
+	double sum = 0;
+	for (int i = 0; i < protoLength; i++) {
+		double t = i - centre;
+		double sinc = t == 0 ? 2.0 * cutoff : sin(2.0 * pi * cutoff * t) / (pi * t);
+		double w = t / centre;
+		double window = BesselI0(beta * sqrt(std::max(0.0, 1.0 - w * w))) / BesselI0(beta);
+		proto[i] = sinc * window;
+		sum += proto[i];
+	}
+
+	// Row p holds proto[k * fir_phases + p] for k = taps-1 .. 0 (oldest sample first);
+	// the extra row p = fir_phases is the next tap over, for interpolation
+	coefficients.assign((size_t)(fir_phases + 1) * taps, 0.0f);
+	for (int p = 0; p <= fir_phases; p++) {
+		for (int k = 0; k < taps; k++) {
+			int index = k * fir_phases + p;
+			double c = index < protoLength ? proto[index] * fir_phases / sum : 0.0;
+			coefficients[(size_t)p * taps + (taps - 1 - k)] = (float)c;
+		}
+	}
+
+	for (int c = 0; c < 2; c++) { history[c].assign((size_t)taps * 2, 0.0f); }
+	historyPos = 0;
+
+	memset(integrator, 0, sizeof(integrator));
+	memset(comb, 0, sizeof(comb));
+	cicCount = 0;
+	cicScale = (float)(1.0 / (pow((double)cic_decimation, cic_order) * 32768.0));
+
+	// CIC samples per output sample, 32.32
+	stepNominal = (uint64_t)llround((double)inputRate / ((double)cic_decimation * outputRate) * 4294967296.0);
+	step = stepNominal;
+	now = 0;
+	position = (uint64_t)taps << 32;	// let the history fill first
+}
+
+void SimDecimator::SetRateAdjust(double ratio) {
+	step = (uint64_t)(stepNominal * ratio);
+}
+
+bool SimDecimator::Push(int left, int right, float* outLeft, float* outRight) {
+	// CIC integrators run at the input rate; unsigned arithmetic wraps cleanly
+	// and the combs undo the wrap as long as the gain fits in 64 bits
+#ifdef RESAMPLER_SSE2
+	__m128i x = _mm_set_epi64x((int64_t)right, (int64_t)left);
+	for (int i = 0; i < cic_order; i++) {
+		x = _mm_add_epi64(_mm_loadu_si128((const __m128i*)integrator[i]), x);
+		_mm_storeu_si128((__m128i*)integrator[i], x);
+	}
+#else
+	uint64_t l = (uint64_t)(int64_t)left;
+	uint64_t r = (uint64_t)(int64_t)right;
+	for (int i = 0; i < cic_order; i++) {
+		l = integrator[i][0] += l;
+		r = integrator[i][1] += r;
+	}
+#endif
+	if (++cicCount < cic_decimation) { return false; }
+	cicCount = 0;
+
+	// Combs at the decimated rate
+	uint64_t l = integrator[cic_order - 1][0];
+	uint64_t r = integrator[cic_order - 1][1];
+	for (int i = 0; i < cic_order; i++) {
+		uint64_t dl = l - comb[i][0];
+		uint64_t dr = r - comb[i][1];
+		comb[i][0] = l;
+		comb[i][1] = r;
+		l = dl;
+		r = dr;
+	}
+
+	// Append to the FIR history
+	float fl = (float)(int64_t)l * cicScale;
+	float fr = (float)(int64_t)r * cicScale;
+	history[0][historyPos] = history[0][historyPos + taps] = fl;
+	history[1][historyPos] = history[1][historyPos + taps] = fr;
+	if (++historyPos == taps) { historyPos = 0; }
+	now += (uint64_t)1 << 32;
+
+	return Filter(outLeft, outRight);
+}
+
+// Called once per CIC sample; the output rate is below the CIC rate, so at
+// most one output falls between this sample and the next
+bool SimDecimator::Filter(float* outLeft, float* outRight) {
+	if (position >= now + ((uint64_t)1 << 32)) { return false; }
+
+	uint32_t frac = (uint32_t)(position - std::min(position, now));
+	uint32_t phase = frac >> (32 - 6);						// fir_phases = 64
+	float alpha = (float)(frac & ((1u << (32 - 6)) - 1)) * (1.0f / (1u << (32 - 6)));
+	position += step;
+
+	const float* c0 = &coefficients[(size_t)phase * taps];
+	const float* c1 = c0 + taps;
+	const float* hl = &history[0][historyPos];
+	const float* hr = &history[1][historyPos];
+
+#ifdef RESAMPLER_SSE2
+	__m128 l0 = _mm_setzero_ps(), l1 = _mm_setzero_ps();
+	__m128 r0 = _mm_setzero_ps(), r1 = _mm_setzero_ps();
+	for (int i = 0; i < taps; i += 4) {
+		__m128 a = _mm_loadu_ps(c0 + i);
+		__m128 b = _mm_loadu_ps(c1 + i);
+		__m128 xl = _mm_loadu_ps(hl + i);
+		__m128 xr = _mm_loadu_ps(hr + i);
+		l0 = _mm_add_ps(l0, _mm_mul_ps(a, xl));
+		l1 = _mm_add_ps(l1, _mm_mul_ps(b, xl));
+		r0 = _mm_add_ps(r0, _mm_mul_ps(a, xr));
+		r1 = _mm_add_ps(r1, _mm_mul_ps(b, xr));
+	}
+	// out = d0 + alpha * (d1 - d0), then a horizontal sum
+	__m128 va = _mm_set1_ps(alpha);
+	__m128 vl = _mm_add_ps(l0, _mm_mul_ps(va, _mm_sub_ps(l1, l0)));
+	__m128 vr = _mm_add_ps(r0, _mm_mul_ps(va, _mm_sub_ps(r1, r0)));
+	float sl[4], sr[4];
+	_mm_storeu_ps(sl, vl);
+	_mm_storeu_ps(sr, vr);
+	*outLeft = (sl[0] + sl[1]) + (sl[2] + sl[3]);
+	*outRight = (sr[0] + sr[1]) + (sr[2] + sr[3]);
+#else
+	float l0 = 0, l1 = 0, r0 = 0, r1 = 0;
+	for (int i = 0; i < taps; i++) {
+		l0 += c0[i] * hl[i];
+		l1 += c1[i] * hl[i];
+		r0 += c0[i] * hr[i];
+		r1 += c1[i] * hr[i];
+	}
+	*outLeft = l0 + alpha * (l1 - l0);
+	*outRight = r0 + alpha * (r1 - r0);
+#endif
+	return true;
+}
+
+double SimDecimator::Benchmark(int inputRate, int outputRate, double seconds, double* outputsPerSecond) {
+	SimDecimator decimator;
+	decimator.Configure(inputRate, outputRate);
+
+	// 1 kHz square wave at the speaker's level
+	long long count = (long long)(inputRate * seconds);
+	int half_period = inputRate / 2000;
+	long long outputs = 0;
+	float l, r, sink = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (long long i = 0; i < count; i++) {
+		int level = ((i / half_period) & 1) ? 0x3000 : 0;
+		if (decimator.Push(level, level, &l, &r)) {
+			outputs++;
+			sink += l;
+		}
+	}
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	if (outputsPerSecond) { *outputsPerSecond = outputs / seconds; }
+	if (sink == 12345.0f) { outputs++; }	// keep the loop from being optimised away
+	return elapsed * 1e9 / count;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Band-limited decimation from the core clock to an audio rate.
+//
+// Stage 1 is a 4th order CIC decimating by 64 (14.318 MHz -> 223.7 kHz),
+// which keeps aliases into the audio band below -80 dB and costs four adds
+// per input sample.  Stage 2 is a Kaiser-windowed polyphase FIR that
+// resamples the CIC output to the exact output rate: the output position
+// advances in 32.32 fixed point, and coefficients are interpolated between
+// the two nearest of 64 phases.  The FIR passes 0.42 * output rate and stops
+// at half the output rate; the CIC droop at 20 kHz is about 0.5 dB.
+struct SimDecimator {
+public:
+
+	static const int cic_order = 4;
+	static const int cic_decimation = 64;
+	static const int fir_phases = 64;
+
+	int taps;				// FIR taps per phase (multiple of 4)
+
+	SimDecimator();
+	void Configure(int inputRate, int outputRate);
+	// Scale the output period (dynamic rate control); 1.0 is the exact rate
+	void SetRateAdjust(double ratio);
+	// One input sample per clk_sys rising edge; true when an output sample is ready
+	bool Push(int left, int right, float* outLeft, float* outRight);
+
+	// Run a synthetic square wave through the decimator, returns ns per input sample
+	static double Benchmark(int inputRate, int outputRate, double seconds, double* outputsPerSecond);
+
+private:
+	// CIC state, left and right interleaved
+	uint64_t integrator[cic_order][2];
+	uint64_t comb[cic_order][2];
+	int cicCount;
+	float cicScale;
+
+	// FIR: (fir_phases + 1) reversed coefficient rows of 'taps' floats, and a
+	// doubled history per channel so the newest 'taps' samples are contiguous
+	std::vector<float> coefficients;
+	std::vector<float> history[2];
+	int historyPos;
+
+	uint64_t position;		// next output time in CIC samples, 32.32
+	uint64_t stepNominal;
+	uint64_t step;
+	uint64_t now;			// time of the newest CIC sample, 32.32
+
+	bool Filter(float* outLeft, float* outRight);
+};
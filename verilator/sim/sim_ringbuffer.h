@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// Single-producer / single-consumer ring of fixed-size items.
+// The simulation thread pushes, one consumer thread (the SDL audio callback,
+// a writer thread) pops.  No locks: each side owns one index and publishes it
+// with release ordering.  Capacity is rounded up to a power of two.
+template <typename T>
+struct SimRingBuffer {
+public:
+
+	SimRingBuffer(size_t capacity = 0) { Resize(capacity); }
+
+	// Not thread safe: only call while neither side is running
+	void Resize(size_t capacity) {
+		size_t size = 1;
+		while (size < capacity) { size <<= 1; }
+		items.assign(size, T());
+		mask = size - 1;
+		head.store(0);
+		tail.store(0);
+	}
+
+	size_t Capacity() const { return mask + 1; }
+
+	// Approximate from either side, exact from the caller's own side
+	size_t Size() const { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+
+	// Producer side
+	bool Push(const T& item) {
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h - tail.load(std::memory_order_acquire) > mask) { return false; }
+		items[h & mask] = item;
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side: copies up to count items, returns how many
+	size_t Pop(T* out, size_t count) {
+		size_t t = tail.load(std::memory_order_relaxed);
+		size_t available = head.load(std::memory_order_acquire) - t;
+		if (count > available) { count = available; }
+		for (size_t i = 0; i < count; i++) { out[i] = items[(t + i) & mask]; }
+		tail.store(t + count, std::memory_order_release);
+		return count;
+	}
+
+private:
+	std::vector<T> items;
+	size_t mask;
+	// Separate cache lines so the two sides do not false-share
+	alignas(64) std::atomic<size_t> head;
+	alignas(64) std::atomic<size_t> tail;
+};
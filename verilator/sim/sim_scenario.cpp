@@ -0,0 +1,278 @@
+#include "sim_scenario.h"
+#include "sim_png.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+SimScenario::SimScenario(SimInput& input, SimBlockDevice& blockdevice) : input(input), blockdevice(blockdevice)
+{
+	active = false;
+	finished = false;
+	updateGolden = false;
+	stats_checked = 0;
+	stats_created = 0;
+	failFrame = -1;
+	next = 0;
+	endFrame = 0;
+}
+
+static std::string Unescape(const std::string& text) {
+	std::string out;
+	for (size_t i = 0; i < text.size(); i++) {
+		if (text[i] == '\\' && i + 1 < text.size()) {
+			char c = text[++i];
+			if (c == 'n') { out += '\n'; }
+			else if (c == 'b') { out += '\b'; }
+			else if (c == 's') { out += ' '; }
+			else { out += c; }
+		}
+		else {
+			out += text[i];
+		}
+	}
+	return out;
+}
+
+bool SimScenario::Load(std::string file) {
+	std::ifstream in(file);
+	if (!in) {
+		fprintf(stderr, "scenario: cannot open %s\n", file.c_str());
+		return false;
+	}
+
+	name = file;
+	steps.clear();
+	endFrame = 0;
+	int line_number = 0;
+	std::string line;
+	while (std::getline(in, line)) {
+		line_number++;
+		if (!line.empty() && line.back() == '\r') { line.pop_back(); }
+		size_t start = line.find_first_not_of(" \t");
+		if (start == std::string::npos || line[start] == '#') { continue; }
+
+		std::istringstream fields(line);
+		SimScenario_Step step;
+		std::string command;
+		step.line = line_number;
+		step.drive = 0;
+		step.hash = 0;
+		if (!(fields >> step.frame >> command) || step.frame < 0) {
+			fprintf(stderr, "%s:%d: expected <frame> <command>\n", file.c_str(), line_number);
+			return false;
+		}
+
+		bool ok = true;
+		if (command == "mount") {
+			step.command = SimScenario_Mount;
+			ok = (bool)(fields >> step.drive >> step.arg) && step.drive >= 0 && step.drive < kVDNUM;
+		}
+		else if (command == "eject") {
+			step.command = SimScenario_Eject;
+			ok = (bool)(fields >> step.drive) && step.drive >= 0 && step.drive < kVDNUM;
+		}
+		else if (command == "disk") {
+			step.command = SimScenario_Disk;
+			ok = (bool)(fields >> step.drive >> step.arg) && step.drive >= 0 && step.drive < kVDNUM;
+			if (ok && step.arg != "next" && step.arg != "prev") {
+				ok = step.arg.find_first_not_of("0123456789") == std::string::npos;
+			}
+		}
+		else if (command == "type") {
+			// The rest of the line, less the separating whitespace, is the text
+			step.command = SimScenario_Type;
+			std::string rest;
+			std::getline(fields, rest);
+			size_t first = rest.find_first_not_of(" \t");
+			step.arg = first == std::string::npos ? "" : Unescape(rest.substr(first));
+			ok = !step.arg.empty();
+		}
+		else if (command == "hash") {
+			step.command = SimScenario_Hash;
+			ok = (bool)(fields >> step.arg);
+			if (ok) {
+				char* end;
+				step.hash = strtoull(step.arg.c_str(), &end, 16);
+				ok = *end == 0;
+			}
+		}
+		else if (command == "png") {
+			step.command = SimScenario_Png;
+			ok = (bool)(fields >> step.arg);
+		}
+		else if (command == "end") {
+			step.command = SimScenario_End;
+		}
+		else {
+			fprintf(stderr, "%s:%d: unknown command '%s'\n", file.c_str(), line_number, command.c_str());
+			return false;
+		}
+		if (!ok) {
+			fprintf(stderr, "%s:%d: bad arguments for '%s'\n", file.c_str(), line_number, command.c_str());
+			return false;
+		}
+		// Frame 0 is applied before the core runs, so there is no frame to check
+		if ((step.command == SimScenario_Hash || step.command == SimScenario_Png) && step.frame == 0) {
+			fprintf(stderr, "%s:%d: '%s' needs a completed frame, use frame 1 or later\n", file.c_str(), line_number, command.c_str());
+			return false;
+		}
+
+		if (step.command == SimScenario_End) { endFrame = step.frame; break; }
+		steps.push_back(step);
+	}
+
+	std::stable_sort(steps.begin(), steps.end(), [](const SimScenario_Step& a, const SimScenario_Step& b) { return a.frame < b.frame; });
+	if (!endFrame && !steps.empty()) { endFrame = steps.back().frame; }
+	if (endFrame <= 0) {
+		fprintf(stderr, "%s: nothing to run\n", file.c_str());
+		return false;
+	}
+
+	if (outPrefix.empty()) {
+		std::string base = file.substr(file.find_last_of("/\\") + 1);
+		outPrefix = base.substr(0, base.find_last_of('.'));
+	}
+	return true;
+}
+
+void SimScenario::Start() {
+	next = 0;
+	failFrame = -1;
+	stats_checked = 0;
+	stats_created = 0;
+	finished = false;
+	active = true;
+	while (next < steps.size() && steps[next].frame == 0) { Apply(steps[next++]); }
+}
+
+void SimScenario::Apply(const SimScenario_Step& step) {
+	if (step.command == SimScenario_Mount) { blockdevice.MountDisk(step.arg, step.drive); }
+	else if (step.command == SimScenario_Eject) { blockdevice.EjectDisk(step.drive); }
+	else if (step.command == SimScenario_Disk) {
+		int position = blockdevice.playlistPos[step.drive];
+		if (step.arg == "next") { position++; }
+		else if (step.arg == "prev") { position--; }
+		else { position = atoi(step.arg.c_str()); }
+		blockdevice.SelectDisk(step.drive, position);
+	}
+	else if (step.command == SimScenario_Type) { input.TypeText(step.arg); }
+}
+
+bool SimScenario::Frame(SimFramebuffer& fb) {
+	if (!active || finished) { return finished; }
+
+	int frame = fb.count_frame;
+	while (next < steps.size() && steps[next].frame <= frame) {
+		const SimScenario_Step& step = steps[next++];
+		if (step.command == SimScenario_Hash || step.command == SimScenario_Png) {
+			if (step.frame == frame && !Check(step, fb)) {
+				finished = true;
+				return true;
+			}
+		}
+		else {
+			Apply(step);
+		}
+	}
+
+	if (frame >= endFrame) {
+		finished = true;
+		printf("scenario %s: passed, %d checks", name.c_str(), stats_checked);
+		if (stats_created) { printf(", %d reference images written", stats_created); }
+		printf(" (%d frames)\n", frame);
+	}
+	return finished;
+}
+
+bool SimScenario::Check(const SimScenario_Step& step, SimFramebuffer& fb) {
+	stats_checked++;
+
+	if (step.command == SimScenario_Hash) {
+		if (fb.frame_hash == step.hash) { return true; }
+		char reason[128];
+		snprintf(reason, sizeof(reason), "hash %016llx, expected %016llx", (unsigned long long)fb.frame_hash, (unsigned long long)step.hash);
+		Fail(step, fb, reason, NULL);
+		return false;
+	}
+
+	// --golden-dir keeps the references by file name in a directory of their own
+	std::string file = step.arg;
+	if (!goldenDir.empty()) { file = goldenDir + "/" + file.substr(file.find_last_of("/\\") + 1); }
+
+	std::vector<uint32_t> reference;
+	int width, height;
+	if (updateGolden) {
+		if (!SimPngWrite(file.c_str(), fb.output_ptr, fb.output_width, fb.output_height)) {
+			Fail(step, fb, "cannot write reference image", NULL);
+			return false;
+		}
+		printf("scenario %s: frame %d written to %s\n", name.c_str(), fb.count_frame, file.c_str());
+		stats_created++;
+		return true;
+	}
+	if (!SimPngRead(file.c_str(), reference, &width, &height)) {
+		char reason[1200];
+		snprintf(reason, sizeof(reason), "cannot read reference %s (--update-golden writes it)", file.c_str());
+		Fail(step, fb, reason, NULL);
+		return false;
+	}
+
+	if (width != fb.output_width || height != fb.output_height) {
+		char reason[128];
+		snprintf(reason, sizeof(reason), "reference is %dx%d, frame is %dx%d", width, height, fb.output_width, fb.output_height);
+		Fail(step, fb, reason, NULL);
+		return false;
+	}
+	// Alpha is not significant, references may come from RGB PNGs
+	size_t count = (size_t)width * height;
+	for (size_t i = 0; i < count; i++) {
+		if ((reference[i] ^ fb.output_ptr[i]) & 0x00FFFFFF) {
+			Fail(step, fb, "pixels differ", &reference);
+			return false;
+		}
+	}
+	return true;
+}
+
+void SimScenario::Fail(const SimScenario_Step& step, SimFramebuffer& fb, const char* reason, const std::vector<uint32_t>* reference) {
+	failFrame = fb.count_frame;
+	fprintf(stderr, "%s:%d: frame %d mismatch: %s\n", name.c_str(), step.line, failFrame, reason);
+
+	char file[1024];
+	snprintf(file, sizeof(file), "%s_frame%d_actual.png", outPrefix.c_str(), failFrame);
+	if (SimPngWrite(file, fb.output_ptr, fb.output_width, fb.output_height)) {
+		fprintf(stderr, "  actual frame: %s\n", file);
+	}
+	if (!reference) { return; }
+
+	int width = fb.output_width;
+	int height = fb.output_height;
+	std::vector<uint32_t> diff((size_t)width * height);
+	int differing = 0;
+	int x0 = width, y0 = height, x1 = -1, y1 = -1;
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			size_t i = (size_t)y * width + x;
+			uint32_t p = fb.output_ptr[i];
+			if (((*reference)[i] ^ p) & 0x00FFFFFF) {
+				diff[i] = 0xFF0000FF;
+				differing++;
+				x0 = std::min(x0, x); x1 = std::max(x1, x);
+				y0 = std::min(y0, y); y1 = std::max(y1, y);
+			}
+			else {
+				uint32_t grey = (((p & 0xFF) + ((p >> 8) & 0xFF) + ((p >> 16) & 0xFF)) / 3) / 3;
+				diff[i] = 0xFF000000 | grey << 16 | grey << 8 | grey;
+			}
+		}
+	}
+	fprintf(stderr, "  %d pixels differ within (%d,%d)-(%d,%d)\n", differing, x0, y0, x1, y1);
+
+	snprintf(file, sizeof(file), "%s_frame%d_diff.png", outPrefix.c_str(), failFrame);
+	if (SimPngWrite(file, diff.data(), width, height)) {
+		fprintf(stderr, "  diff image: %s\n", file);
+	}
+}
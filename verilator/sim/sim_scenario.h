@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "sim_framebuffer.h"
+#include "sim_input.h"
+#include "sim_blkdevice.h"
+
+// Golden-frame regression scenarios.
+//
+// A scenario is a text file of "<frame> <command> [arguments]" lines, run in
+// frame order.  Frame 0 commands are applied before the core starts, so
+// hash and png checks must name frame 1 or later.
+//
+//   # boot DOS and list the disk
+//   0    mount  0 disks/dos.nib
+//   120  type   CATALOG\n
+//   300  hash   77482505d75c18eb
+//   300  png    golden/catalog.png
+//   400  end
+//
+// mount <drive> <file>  insert a disk image
+// eject <drive>         remove it
+// disk <drive> <n>      insert playlist entry n (from 0), or "next"/"prev"
+// type <text>           queue key presses (\n return, \b backspace, \s space, \\ backslash)
+// hash <hex>            compare the completed frame hash
+// png <file>            compare against a reference PNG (--update-golden writes it)
+// end                   stop here; defaults to the last command's frame
+//
+// A missing reference PNG fails the check unless --update-golden is given, so
+// a scenario never passes by writing its own references.  The first mismatch
+// stops the run.  The actual frame is written next to the output prefix and,
+// for PNG references, a diff image with differing pixels in red over a dimmed
+// copy of the frame.
+enum SimScenario_Command {
+	SimScenario_Mount,
+	SimScenario_Eject,
+	SimScenario_Disk,
+	SimScenario_Type,
+	SimScenario_Hash,
+	SimScenario_Png,
+	SimScenario_End
+};
+
+struct SimScenario_Step {
+	int frame;
+	SimScenario_Command command;
+	int drive;
+	uint64_t hash;
+	std::string arg;
+	int line;
+};
+
+struct SimScenario {
+public:
+
+	bool active;
+	bool finished;
+	bool updateGolden;		// Rewrite reference PNGs instead of comparing
+	std::string goldenDir;	// Reference PNGs by file name in this directory instead of their scenario paths
+	std::string outPrefix;	// Prefix for actual/diff images of a failing frame
+
+	int stats_checked;
+	int stats_created;
+	int failFrame;			// -1 while everything matched
+
+	bool Load(std::string file);
+	void Start();
+	// Call once per completed frame; returns true once the scenario has finished
+	bool Frame(SimFramebuffer& fb);
+	int ExitCode() { return failFrame >= 0 ? 1 : 0; }
+
+	SimScenario(SimInput& input, SimBlockDevice& blockdevice);
+
+private:
+	SimInput& input;
+	SimBlockDevice& blockdevice;
+	std::string name;
+	std::vector<SimScenario_Step> steps;
+	size_t next;
+	int endFrame;
+
+	void Apply(const SimScenario_Step& step);
+	bool Check(const SimScenario_Step& step, SimFramebuffer& fb);
+	void Fail(const SimScenario_Step& step, SimFramebuffer& fb, const char* reason, const std::vector<uint32_t>* reference);
+};
@@ -0,0 +1,61 @@
+#include "sim_trackcache.h"
+#include "sim_nibble.h"
+
+#include <iterator>
+
+SimTrackCache::SimTrackCache()
+{
+	capacity = 64;
+	trackSize = kNIBTRACKSZ;
+	stats_hits = 0;
+	stats_misses = 0;
+	stats_prefetches = 0;
+	stats_prefetchHits = 0;
+}
+
+uint8_t* SimTrackCache::Find(int drive, int track, bool* prefetched) {
+	auto found = index.find(Key(drive, track));
+	if (found == index.end()) { return NULL; }
+
+	entries.splice(entries.begin(), entries, found->second);
+	Entry& entry = entries.front();
+	if (prefetched) { *prefetched = entry.prefetched; }
+	entry.prefetched = false;
+	return entry.data.data();
+}
+
+uint8_t* SimTrackCache::Insert(int drive, int track, bool prefetched) {
+	uint32_t key = Key(drive, track);
+	auto found = index.find(key);
+	if (found != index.end()) {
+		entries.splice(entries.begin(), entries, found->second);
+		return entries.front().data.data();
+	}
+
+	// Reuse the oldest entry's buffer when full
+	if ((int)entries.size() >= capacity && !entries.empty()) {
+		index.erase(entries.back().key);
+		entries.splice(entries.begin(), entries, std::prev(entries.end()));
+	}
+	else {
+		entries.push_front(Entry());
+	}
+	Entry& entry = entries.front();
+	entry.key = key;
+	entry.prefetched = prefetched;
+	entry.data.resize(trackSize);
+	index[key] = entries.begin();
+	return entry.data.data();
+}
+
+void SimTrackCache::Invalidate(int drive) {
+	for (auto entry = entries.begin(); entry != entries.end();) {
+		if ((int)(entry->key >> 16) == drive) {
+			index.erase(entry->key);
+			entry = entries.erase(entry);
+		}
+		else {
+			++entry;
+		}
+	}
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+// Nibble tracks staged on the host, keyed by (drive, track), least recently
+// used first out.  SimBlockDevice fills it on a miss and when prefetching
+// ahead of the head; hits are served without the request latency.
+struct SimTrackCache {
+public:
+
+	int capacity;				// tracks
+	int trackSize;
+
+	int stats_hits;				// track loads served from the cache
+	int stats_misses;
+	int stats_prefetches;		// tracks staged ahead of the head
+	int stats_prefetchHits;		// of which were later used
+
+	// NULL when absent; a hit moves the track to the front and reports
+	// (once) whether it got there by prefetch
+	uint8_t* Find(int drive, int track, bool* prefetched);
+	bool Contains(int drive, int track) { return index.count(Key(drive, track)) != 0; }
+	// Buffer to fill for a new track, evicting the oldest if full
+	uint8_t* Insert(int drive, int track, bool prefetched);
+	void Invalidate(int drive);
+
+	SimTrackCache();
+
+private:
+	struct Entry {
+		uint32_t key;
+		bool prefetched;
+		std::vector<uint8_t> data;
+	};
+	std::list<Entry> entries;		// most recently used first
+	std::unordered_map<uint32_t, std::list<Entry>::iterator> index;
+
+	static uint32_t Key(int drive, int track) { return ((uint32_t)drive << 16) | (uint16_t)track; }
+};
@@ -9,7 +9,6 @@
 #include <stdio.h>
 #include <SDL.h>
 #include <SDL_opengl.h>
-#include <sys/time.h>
 #else
 #define WIN32
 #include "imgui_impl_win32.h"
@@ -21,15 +20,11 @@
 // Renderer variables
 // ------------------
 
-int output_width = 512;
-int output_height = 512;
-int output_rotate = 0;
-bool output_vflip = false;
 bool output_usevsync = 1;
 
-uint32_t* output_ptr = NULL;
-unsigned int output_size;
 #ifdef WIN32
+static const int swapchain_width = 512;
+static const int swapchain_height = 512;
 HWND hwnd;
 WNDCLASSEX wc;
 #else
@@ -37,38 +32,10 @@ SDL_Window* window;
 SDL_GLContext gl_context;
 GLuint tex;
 #endif
-ImTextureID texture_id;
 ImGuiIO io;
 
 ImVec4 clear_color = ImVec4(0.25f, 0.35f, 0.40f, 0.80f);
 
-int count_pixel;
-int count_line;
-int count_frame;
-bool last_hblank;
-bool last_vblank;
-bool last_hsync;
-bool last_vsync;
-bool frame_ready = 1;
-
-// Statistics
-#ifdef WIN32
-SYSTEMTIME actualtime;
-LONG time_ms;
-LONG old_time;
-LONG stats_frameTime;
-#else
-double time_ms;
-double old_time;
-double stats_frameTime;
-#endif
-float stats_fps;
-int stats_xMax;
-int stats_yMax;
-int stats_xMin;
-int stats_yMin;
-
-
 #ifndef WIN32
 SDL_Renderer* renderer = NULL;
 SDL_Texture* texture = NULL;
@@ -118,8 +85,8 @@ HRESULT CreateDeviceD3D(HWND hWnd)
 	DXGI_SWAP_CHAIN_DESC sd;
 	ZeroMemory(&sd, sizeof(sd));
 	sd.BufferCount = 2;
-	sd.BufferDesc.Width = output_width;
-	sd.BufferDesc.Height = output_height;
+	sd.BufferDesc.Width = swapchain_width;
+	sd.BufferDesc.Height = swapchain_height;
 	sd.BufferDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
 	sd.BufferDesc.RefreshRate.Numerator = 60;
 	sd.BufferDesc.RefreshRate.Denominator = 1;
@@ -177,27 +144,13 @@ LRESULT WINAPI WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
 #else
 #endif
 
-SimVideo::SimVideo(int width, int height, int rotate)
+SimVideo::SimVideo(int width, int height, int rotate) : SimFramebuffer(width, height, rotate)
 {
-	output_width = width;
-	output_height = height;
-	output_size = output_width * output_height * 4;
-	output_rotate = rotate;
-	output_vflip = 0;
-
-	count_pixel = 0;
-	count_line = 0;
-	count_frame = 0;
-	last_hblank = 0;
-	last_vblank = 0;
-
-	old_time = 0;
-	stats_frameTime = 0;
-	stats_fps = 0.0;
-	stats_xMax = -1000;
-	stats_yMax = -1000;
-	stats_xMin = 1000;
-	stats_yMin = 1000;
+	texture_id = 0;
+	stats_uploads = 0;
+	stats_uploadsSkipped = 0;
+	stats_uploadRows = 0;
+	stats_uploadSpans = 0;
 }
 
 SimVideo::~SimVideo()
@@ -208,7 +161,7 @@ SimVideo::~SimVideo()
 int SimVideo::Initialise(const char* windowTitle) {
 
 	// Setup pointers for video texture
-	output_ptr = (uint32_t*)malloc(output_size);
+	Allocate();
 
 #ifdef WIN32
 	// Create application window
@@ -269,9 +222,6 @@ int SimVideo::Initialise(const char* windowTitle) {
 
 #endif
 
-	memset(output_ptr, 0xAA, output_size);
-
-
 #ifdef WIN32
 	// Upload texture to graphics system
 	D3D11_TEXTURE2D_DESC desc;
@@ -335,13 +285,41 @@ int SimVideo::Initialise(const char* windowTitle) {
 
 void SimVideo::UpdateTexture() {
 
+	// Dirty rows are the only record of what the texture is missing, so any
+	// dirty row forces an upload (UpdateTexture also runs mid-frame, when
+	// frame_hash still describes the previous frame) and the marks are only
+	// cleared once the rows have been sent
+	bool upload = frame_ready && dirty_rows;
+	if (upload) {
+		stats_uploads++;
+		stats_uploadRows = 0;
+		stats_uploadSpans = 0;
+	}
+	else if (frame_ready) {
+		stats_uploadsSkipped++;
+	}
+
+#ifndef WIN32
+	if (upload) { glBindTexture(GL_TEXTURE_2D, tex); }
+#endif
+	// Send each run of dirty rows as one sub-rectangle
+	for (int y = 0; upload && y < output_height; y++) {
+		if (!row_dirty[y]) { continue; }
+		int y0 = y;
+		while (y < output_height && row_dirty[y]) { y++; }
+		const uint32_t* rows = output_ptr + (size_t)y0 * output_width;
 #ifdef WIN32
-	// Update the texture!
-	// D3D11_USAGE_DEFAULT MUST be set in the texture description (somewhere above) for this to work.
-	// (D3D11_USAGE_DYNAMIC is for use with map / unmap.) ElectronAsh.
-	if (frame_ready) {
-		g_pd3dDeviceContext->UpdateSubresource(texture, 0, NULL, output_ptr, output_width * 4, 0);
+		D3D11_BOX box = { 0, (UINT)y0, 0, (UINT)output_width, (UINT)y, 1 };
+		g_pd3dDeviceContext->UpdateSubresource(texture, 0, &box, rows, output_width * 4, 0);
+#else
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y0, output_width, y - y0, GL_RGBA, GL_UNSIGNED_BYTE, rows);
+#endif
+		stats_uploadRows += y - y0;
+		stats_uploadSpans++;
 	}
+	if (upload) { ClearDirty(); }
+
+#ifdef WIN32
 	// Rendering
 	ImGui::Render();
 	g_pd3dDeviceContext->OMSetRenderTargets(1, &g_mainRenderTargetView, NULL);
@@ -349,9 +327,6 @@ void SimVideo::UpdateTexture() {
 	ImGui_ImplDX11_RenderDrawData(ImGui::GetDrawData());
 	g_pSwapChain->Present(output_usevsync, 0); // Present without vsync
 #else
-	if (frame_ready) {
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, output_width, output_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, output_ptr);
-	}
 	// Rendering
 	ImGui::Render();
 	glViewport(0, 0, (int)io.DisplaySize.x, (int)io.DisplaySize.y);
@@ -398,97 +373,3 @@ void SimVideo::StartFrame() {
 	ImGui_ImplSDL2_NewFrame(window);
 #endif
 }
-
-void SimVideo::Clock(bool hblank, bool vblank, bool hsync, bool vsync, uint32_t colour) {
-
-	bool de = !(hblank || vblank);
-
-	bool hs_falling = (!hsync && last_hsync);
-	bool hs_rising = (hsync && !last_hsync);
-	bool hb_falling = (!hblank && last_hblank);
-	bool hb_rising = (hblank && !last_hblank);
-	bool vs_falling = (!vsync && last_vsync);
-	bool vs_rising = (vsync && !last_vsync);
-	bool vb_falling = (!vblank && last_vblank);
-	bool vb_rising = (vblank && !last_vblank);
-
-	if (!vblank) {
-		// Next line on end of hblank
-		if (hb_falling) {
-			// Increment line and reset pixel count
-			count_line++;
-			count_pixel = 0;
-		}
-		if (de) {
-			count_pixel++;
-		}
-	}
-
-	//frame_ready = 1;
-	// Reset on rising vsync
-	if (last_vsync && !vsync) {
-		count_frame++;
-		count_line = 0;
-		frame_ready = 1;
-#ifdef WIN32
-		GetSystemTime(&actualtime);
-		time_ms = (actualtime.wSecond * 1000) + actualtime.wMilliseconds;
-#else
-		struct timeval tv;
-		gettimeofday(&tv, NULL);
-		time_ms = (tv.tv_sec) * 1000 + (tv.tv_usec) / 1000; // convert tv_sec & tv_usec to millisecond
-#endif
-		stats_frameTime = time_ms - old_time;
-		old_time = time_ms;
-		stats_fps = (float)(1000.0 / stats_frameTime);
-	}
-
-	// Only draw outside of blanks
-	if (de) {
-
-		int ox = count_pixel - 1;
-		int oy = count_line - 1;
-		int x = ox, xs = output_width, y = oy;
-
-		if (output_rotate == -1) {
-			// Rotate output by 90 degrees clockwise
-			y = output_height - ox;
-			xs = output_width;
-			x = oy;
-		}
-		if (output_rotate == 1) {
-			// Rotate output by 90 degrees clockwise
-			y = ox;
-			xs = output_width;
-			x = output_width - oy;
-		}
-
-		if (output_vflip) {
-			y = output_height - y;
-		}
-
-		// Clamp values to stop access violations on texture
-		if (x < 0) { x = 0; }
-		if (x > output_width - 1) { x = output_width - 1; }
-		if (y < 0) { y = 0; }
-		if (y > output_height - 1) { y = output_height - 1; }
-
-		// Generate texture address
-		uint32_t vga_addr = (y * xs) + x;
-
-		// Write pixel to texture
-		output_ptr[vga_addr] = colour;
-
-	}
-
-	// Track bounds (debug)
-	if (count_pixel > stats_xMax) { stats_xMax = count_pixel; }
-	if (count_line > stats_yMax) { stats_yMax = count_line; }
-	if (count_pixel < stats_xMin) { stats_xMin = count_pixel; }
-	if (count_line < stats_yMin) { stats_yMin = count_line; }
-
-	last_hblank = hblank;
-	last_vblank = vblank;
-	last_hsync = hsync;
-	last_vsync = vsync;
-}
\ No newline at end of file
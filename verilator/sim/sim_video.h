@@ -2,7 +2,10 @@
 
 #include <string>
 #include <cstdint>
-#ifndef _MSC_VER
+#include "sim_framebuffer.h"
+#ifdef SIM_HEADLESS
+#include "imgui.h"
+#elif !defined(_MSC_VER)
 #include "imgui_impl_sdl.h"
 #include "imgui_impl_opengl2.h"
 #else
@@ -13,32 +16,25 @@
 #include <tchar.h>
 #endif
 
-struct SimVideo {
+// Presentation half of the video output.  sim_video.cpp presents through
+// SDL/OpenGL or DirectX; sim_video_null.cpp is the null presenter linked into
+// headless builds, which keeps producing frames without a window or GPU.
+struct SimVideo : public SimFramebuffer {
 public:
 
-	int output_width;
-	int output_height;
-	int output_rotate;
-	bool output_vflip;
-
-	int count_pixel;
-	int count_line;
-	int count_frame;
-
-	float stats_fps;
-	float stats_frameTime;
-	int stats_xMax;
-	int stats_xMin;
-	int stats_yMax;
-	int stats_yMin;
-
 	ImTextureID texture_id;
 
+	// Texture uploads are skipped while the completed frame hash is unchanged,
+	// otherwise only runs of dirty rows are sent
+	int stats_uploads;
+	int stats_uploadsSkipped;
+	int stats_uploadRows;		// rows sent by the last upload
+	int stats_uploadSpans;		// separate row runs in the last upload
+
 	SimVideo(int width, int height, int rotate);
 	~SimVideo();
 	void UpdateTexture();
 	void CleanUp();
 	void StartFrame();
-	void Clock(bool hblank, bool vblank, bool hsync, bool vsync, uint32_t colour);
 	int Initialise(const char* windowTitle);
 };
@@ -0,0 +1,37 @@
+#include "sim_video.h"
+
+// Null presenter for headless builds
+// ----------------------------------
+// No window, no GL/DirectX context and no SDL: the framebuffer is still
+// filled by SimFramebuffer::Clock so frames can be captured and hashed.
+
+SimVideo::SimVideo(int width, int height, int rotate) : SimFramebuffer(width, height, rotate)
+{
+	texture_id = 0;
+	stats_uploads = 0;
+	stats_uploadsSkipped = 0;
+	stats_uploadRows = 0;
+	stats_uploadSpans = 0;
+}
+
+SimVideo::~SimVideo()
+{
+
+}
+
+int SimVideo::Initialise(const char* windowTitle) {
+	(void)windowTitle;
+	Allocate();
+	return 0;
+}
+
+void SimVideo::UpdateTexture() {
+	if (frame_ready) { ClearDirty(); }
+	frame_ready = 0;
+}
+
+void SimVideo::CleanUp() {
+}
+
+void SimVideo::StartFrame() {
+}
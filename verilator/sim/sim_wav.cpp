@@ -0,0 +1,162 @@
+#include "sim_wav.h"
+
+#include <algorithm>
+#include <cstring>
+
+static const size_t block_bytes = 1 << 20;
+
+SimWavWriter::SimWavWriter()
+{
+	file = NULL;
+	format = SimWav_PCM16;
+	rate = 0;
+	frameBytes = 0;
+	dataBytes = 0;
+	stopping = false;
+	stats_frames = 0;
+	stats_flushes = 0;
+}
+
+SimWavWriter::~SimWavWriter()
+{
+	Close();
+}
+
+bool SimWavWriter::FormatFromName(std::string name, SimWav_Format* format) {
+	if (name == "pcm16" || name == "16") { *format = SimWav_PCM16; }
+	else if (name == "float" || name == "f32") { *format = SimWav_Float; }
+	else { return false; }
+	return true;
+}
+
+bool SimWavWriter::Open(std::string path, int rate, SimWav_Format format) {
+	Close();
+
+	file = fopen(path.c_str(), "wb");
+	if (!file) { return false; }
+	this->rate = rate;
+	this->format = format;
+	frameBytes = format == SimWav_Float ? 8 : 4;
+	dataBytes = 0;
+	stats_frames = 0;
+	stats_flushes = 0;
+	WriteHeader();
+
+	current.clear();
+	current.reserve(block_bytes);
+	stopping = false;
+	worker = std::thread(&SimWavWriter::Run, this);
+	return true;
+}
+
+void SimWavWriter::Write(float left, float right) {
+	if (!file) { return; }
+
+	// Samples are stored little endian, as on every host this harness builds for
+	uint8_t frame[8];
+	if (format == SimWav_Float) {
+		memcpy(frame, &left, 4);
+		memcpy(frame + 4, &right, 4);
+	}
+	else {
+		int16_t l = (int16_t)std::max(-32768.0f, std::min(32767.0f, left * 32768.0f));
+		int16_t r = (int16_t)std::max(-32768.0f, std::min(32767.0f, right * 32768.0f));
+		memcpy(frame, &l, 2);
+		memcpy(frame + 2, &r, 2);
+	}
+	current.insert(current.end(), frame, frame + frameBytes);
+	if (current.size() >= block_bytes) { Submit(); }
+}
+
+void SimWavWriter::Submit() {
+	std::lock_guard<std::mutex> guard(lock);
+	pending.push_back(std::move(current));
+	if (!spare.empty()) {
+		current = std::move(spare.back());
+		spare.pop_back();
+	}
+	else {
+		current = std::vector<uint8_t>();
+	}
+	current.clear();
+	current.reserve(block_bytes);
+	wake.notify_one();
+}
+
+void SimWavWriter::Run() {
+	for (;;) {
+		std::vector<uint8_t> block;
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			wake.wait(guard, [this] { return !pending.empty() || stopping; });
+			if (pending.empty()) { return; }
+			block = std::move(pending.front());
+			pending.pop_front();
+		}
+
+		fwrite(block.data(), 1, block.size(), file);
+		dataBytes += block.size();
+		stats_frames += block.size() / frameBytes;
+		stats_flushes++;
+		WriteHeader();
+
+		std::lock_guard<std::mutex> guard(lock);
+		if (spare.size() < 2) { spare.push_back(std::move(block)); }
+	}
+}
+
+void SimWavWriter::Close() {
+	if (!file) { return; }
+
+	if (!current.empty()) { Submit(); }
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+		wake.notify_one();
+	}
+	worker.join();
+
+	fclose(file);
+	file = NULL;
+	spare.clear();
+}
+
+static void Put16(uint8_t* p, uint32_t v) { p[0] = v & 0xFF; p[1] = (v >> 8) & 0xFF; }
+static void Put32(uint8_t* p, uint32_t v) { Put16(p, v & 0xFFFF); Put16(p + 2, v >> 16); }
+
+// Rewrites the header for the data written so far and returns to the end.
+// Sizes saturate at 4 GB, the limit of the RIFF format.
+void SimWavWriter::WriteHeader() {
+	bool is_float = format == SimWav_Float;
+	uint32_t data = (uint32_t)std::min<uint64_t>(dataBytes, 0xFFFFFFFFull - 64);
+	uint8_t header[58];
+	size_t size = 0;
+
+	memcpy(header, "RIFF", 4);
+	memcpy(header + 8, "WAVEfmt ", 8);
+	Put32(header + 16, is_float ? 18 : 16);
+	Put16(header + 20, is_float ? 3 : 1);			// IEEE float or PCM
+	Put16(header + 22, 2);
+	Put32(header + 24, rate);
+	Put32(header + 28, rate * frameBytes);
+	Put16(header + 32, frameBytes);
+	Put16(header + 34, is_float ? 32 : 16);
+	size = 36;
+	if (is_float) {
+		// Non-PCM formats carry cbSize and a fact chunk with the frame count
+		Put16(header + 36, 0);
+		memcpy(header + 38, "fact", 4);
+		Put32(header + 42, 4);
+		Put32(header + 46, data / frameBytes);
+		size = 50;
+	}
+	memcpy(header + size, "data", 4);
+	Put32(header + size + 4, data);
+	size += 8;
+	Put32(header + 4, (uint32_t)(size - 8 + data));
+
+	fseek(file, 0, SEEK_SET);
+	fwrite(header, 1, size, file);
+	fseek(file, 0, SEEK_END);
+	fflush(file);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum SimWav_Format {
+	SimWav_PCM16,
+	SimWav_Float
+};
+
+// Streaming stereo WAV writer.
+// Write() converts into a 1 MB block; full blocks go to a worker thread that
+// writes them and then rewrites the RIFF/data sizes, so the file on disk is a
+// valid WAV up to the last flushed block even if the process is killed.
+// Close() flushes the partial block and patches the header a final time.
+struct SimWavWriter {
+public:
+
+	std::atomic<uint64_t> stats_frames;		// frames written to disk
+	std::atomic<int> stats_flushes;
+
+	bool Open(std::string path, int rate, SimWav_Format format);
+	void Write(float left, float right);
+	void Close();
+	bool IsOpen() { return file != NULL; }
+	static bool FormatFromName(std::string name, SimWav_Format* format);
+
+	SimWavWriter();
+	~SimWavWriter();
+
+private:
+	FILE* file;
+	SimWav_Format format;
+	int rate;
+	int frameBytes;
+	uint64_t dataBytes;		// worker side
+
+	std::vector<uint8_t> current;
+	std::deque<std::vector<uint8_t>> pending;
+	std::vector<std::vector<uint8_t>> spare;
+
+	std::mutex lock;
+	std::condition_variable wake;
+	bool stopping;
+	std::thread worker;
+
+	void Submit();
+	void Run();
+	void WriteHeader();
+};
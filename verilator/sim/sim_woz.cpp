@@ -0,0 +1,104 @@
+#include "sim_woz.h"
+#include "sim_nibble.h"
+
+#include <cstdio>
+#include <cstring>
+
+static inline uint16_t Get16(const uint8_t* p) { return p[0] | (p[1] << 8); }
+static inline uint32_t Get32(const uint8_t* p) { return Get16(p) | ((uint32_t)Get16(p + 2) << 16); }
+
+SimWoz::SimWoz()
+{
+	version = 0;
+	tracks = 0;
+	file = NULL;
+	size = 0;
+	trks = NULL;
+	trksSize = 0;
+	memset(tmap, 0xFF, sizeof(tmap));
+}
+
+bool SimWoz::Parse(const uint8_t* file, uint64_t size) {
+	this->file = file;
+	this->size = size;
+	version = 0;
+	tracks = 0;
+	trks = NULL;
+	memset(tmap, 0xFF, sizeof(tmap));
+
+	if (size < 12 || memcmp(file + 4, "\xFF\x0A\x0D\x0A", 4) != 0) { return false; }
+	if (memcmp(file, "WOZ1", 4) == 0) { version = 1; }
+	else if (memcmp(file, "WOZ2", 4) == 0) { version = 2; }
+	else { return false; }
+
+	bool tmap_found = false;
+	for (uint64_t offset = 12; offset + 8 <= size;) {
+		const uint8_t* id = file + offset;
+		uint32_t length = Get32(file + offset + 4);
+		const uint8_t* chunk = file + offset + 8;
+		if (offset + 8 + length > size) { break; }
+
+		if (memcmp(id, "INFO", 4) == 0 && length >= 2 && chunk[1] != 1) {
+			fprintf(stderr, "WOZ: only 5.25\" disks are supported\n");
+			return false;
+		}
+		if (memcmp(id, "TMAP", 4) == 0 && length >= 160) {
+			memcpy(tmap, chunk, 160);
+			tmap_found = true;
+		}
+		if (memcmp(id, "TRKS", 4) == 0) {
+			trks = chunk;
+			trksSize = length;
+		}
+		offset += 8 + length;
+	}
+	if (!tmap_found || !trks) { return false; }
+
+	for (int q = 0; q < 160; q++) {
+		if (tmap[q] != 0xFF) { tracks = q / 4 + 1; }
+	}
+	if (tracks < 35) { tracks = 35; }
+	return true;
+}
+
+bool SimWoz::DecodeTrack(int quarterTrack, uint8_t* nibbles) {
+	memset(nibbles, 0xFF, kNIBTRACKSZ);
+	if (quarterTrack < 0 || quarterTrack >= 160 || tmap[quarterTrack] == 0xFF) { return false; }
+	int index = tmap[quarterTrack];
+
+	const uint8_t* bits;
+	uint32_t count;
+	if (version == 1) {
+		// 6656 byte entries: bitstream, then bytes used and bit count
+		if ((uint64_t)(index + 1) * 6656 > trksSize) { return false; }
+		const uint8_t* entry = trks + index * 6656;
+		bits = entry;
+		count = Get16(entry + 6648);
+		if (count > 6646 * 8) { count = 6646 * 8; }
+	}
+	else {
+		// 8 byte entries: first 512 byte block, block count, bit count
+		if ((uint64_t)(index + 1) * 8 > trksSize) { return false; }
+		const uint8_t* entry = trks + index * 8;
+		uint64_t start = (uint64_t)Get16(entry) * 512;
+		count = Get32(entry + 4);
+		if (start + (count + 7) / 8 > size) { return false; }
+		bits = file + start;
+	}
+	if (!count) { return false; }
+
+	// Shift bits into a latch the way the controller does, emitting a byte
+	// whenever the top bit is set.  The first revolution only brings the
+	// latch into step with the sync bytes; the second is recorded.
+	uint8_t latch = 0;
+	int out = 0;
+	for (uint32_t i = 0; i < count * 2 && out < kNIBTRACKSZ; i++) {
+		uint32_t bit = i < count ? i : i - count;
+		latch = (latch << 1) | ((bits[bit >> 3] >> (7 - (bit & 7))) & 1);
+		if (latch & 0x80) {
+			if (i >= count) { nibbles[out++] = latch; }
+			latch = 0;
+		}
+	}
+	return true;
+}
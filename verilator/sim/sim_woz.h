@@ -0,0 +1,26 @@
+#pragma once
+#include <cstdint>
+
+// WOZ 1 and 2 flux-level disk images (5.25" only).
+// Parse() indexes the TMAP and TRKS chunks of an image held in memory (the
+// mapped file); DecodeTrack() turns one quarter-track bitstream into the
+// byte stream a Disk II latch would see, which is what floppy_track expects.
+struct SimWoz {
+public:
+
+	int version;		// 1 or 2
+	int tracks;			// whole tracks mapped by TMAP
+
+	bool Parse(const uint8_t* file, uint64_t size);
+	// Fills kNIBTRACKSZ bytes; false for an unmapped (blank) quarter-track
+	bool DecodeTrack(int quarterTrack, uint8_t* nibbles);
+
+	SimWoz();
+
+private:
+	const uint8_t* file;
+	uint64_t size;
+	uint8_t tmap[160];
+	const uint8_t* trks;
+	uint32_t trksSize;
+};
@@ -0,0 +1,222 @@
+#include "sim_writeback.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#ifdef WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// Journal records: 4 byte tag, LBA (or sector count for a commit), check, sector
+static const int record_size = 12 + SimDiskImage::sector_size;
+
+static uint32_t Check(uint32_t lba, const uint8_t* data) {
+	// FNV-1a, enough to spot a torn record
+	uint32_t hash = 2166136261u;
+	for (int i = 0; i < 4; i++) { hash = (hash ^ ((lba >> (i * 8)) & 0xFF)) * 16777619u; }
+	for (int i = 0; i < SimDiskImage::sector_size; i++) { hash = (hash ^ data[i]) * 16777619u; }
+	return hash;
+}
+
+static void Put32(uint8_t* p, uint32_t v) { p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24; }
+static uint32_t Get32(const uint8_t* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+
+SimWriteBack::SimWriteBack(SimDiskImage* disks, int count, std::mutex& imageLock) : disks(disks), count(count), imageLock(imageLock)
+{
+	enabled = true;
+	journal = true;
+	intervalMs = 250;
+	maxDirty = 256;
+	stats_dirty = 0;
+	stats_coalesced = 0;
+	stats_flushed = 0;
+	stats_flushes = 0;
+	stats_syncMicros = 0;
+	flushRequested = false;
+	stopping = false;
+	flushBusy = false;
+	flushGeneration = 0;
+}
+
+SimWriteBack::~SimWriteBack()
+{
+	Stop();
+}
+
+void SimWriteBack::Start() {
+	if (!enabled || worker.joinable()) { return; }
+	stopping = false;
+	worker = std::thread(&SimWriteBack::Run, this);
+}
+
+void SimWriteBack::Stop() {
+	if (!worker.joinable()) { return; }
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+		flushRequested = true;
+		wake.notify_one();
+	}
+	worker.join();
+}
+
+void SimWriteBack::Write(int drive, uint32_t lba, const uint8_t* data) {
+	std::lock_guard<std::mutex> guard(lock);
+	std::vector<uint8_t>& sector = dirty[Key(drive, lba)];
+	if (sector.empty()) { sector.resize(SimDiskImage::sector_size); }
+	else { stats_coalesced++; }
+	memcpy(sector.data(), data, SimDiskImage::sector_size);
+	stats_dirty = (int)(dirty.size() + flushing.size());
+	if ((int)dirty.size() >= maxDirty) { wake.notify_one(); }
+}
+
+bool SimWriteBack::Read(int drive, uint32_t lba, uint8_t* data) {
+	std::lock_guard<std::mutex> guard(lock);
+	if (dirty.empty() && flushing.empty()) { return false; }
+	uint64_t key = Key(drive, lba);
+	auto found = dirty.find(key);
+	if (found == dirty.end()) {
+		found = flushing.find(key);
+		if (found == flushing.end()) { return false; }
+	}
+	memcpy(data, found->second.data(), SimDiskImage::sector_size);
+	return true;
+}
+
+void SimWriteBack::Flush(bool wait) {
+	if (!worker.joinable()) { return; }
+	std::unique_lock<std::mutex> guard(lock);
+	// A flush already under way may have taken its batch before our last write
+	uint64_t target = flushGeneration + (flushBusy ? 2 : 1);
+	flushRequested = true;
+	wake.notify_one();
+	if (wait) { done.wait(guard, [this, target] { return flushGeneration >= target || stopping; }); }
+}
+
+void SimWriteBack::Run() {
+	std::unique_lock<std::mutex> guard(lock);
+	for (;;) {
+		wake.wait_for(guard, std::chrono::milliseconds(intervalMs), [this] { return flushRequested || stopping || (int)dirty.size() >= maxDirty; });
+		bool sync = flushRequested;
+		flushRequested = false;
+		flushing.swap(dirty);
+		flushBusy = true;
+		guard.unlock();
+
+		if (!flushing.empty() || sync) {
+			auto start = std::chrono::steady_clock::now();
+			std::vector<bool> touched(count, false);
+			for (auto& entry : flushing) { touched[entry.first >> 32] = true; }
+
+			// 1. journal, durable before the images are touched
+			if (journal) {
+				for (int d = 0; d < count; d++) {
+					if (touched[d]) { WriteJournal(d, flushing); }
+				}
+			}
+
+			// 2. apply
+			{
+				std::lock_guard<std::mutex> image(imageLock);
+				for (auto& entry : flushing) { disks[entry.first >> 32].Write((uint32_t)entry.first, entry.second.data()); }
+				for (int d = 0; d < count; d++) {
+					if ((touched[d] || sync) && disks[d].IsOpen()) { disks[d].FlushTracks(); }
+				}
+			}
+
+			// 3. make durable; the journal is no longer needed
+			for (int d = 0; d < count; d++) {
+				if (!(touched[d] || sync) || !disks[d].IsOpen()) { continue; }
+				disks[d].SyncData();
+				if (journal && touched[d] && !disks[d].journalPath.empty()) { remove(disks[d].journalPath.c_str()); }
+			}
+
+			stats_flushed += (int)flushing.size();
+			stats_flushes++;
+			stats_syncMicros = (int)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+		}
+
+		guard.lock();
+		flushing.clear();
+		flushBusy = false;
+		stats_dirty = (int)dirty.size();
+		flushGeneration++;
+		done.notify_all();
+		if (stopping && dirty.empty()) { break; }
+	}
+}
+
+void SimWriteBack::WriteJournal(int drive, const SectorMap& batch) {
+	std::string path = disks[drive].journalPath;
+	if (path.empty()) { return; }
+	FILE* file = fopen(path.c_str(), "ab");
+	if (!file) {
+		fprintf(stderr, "cannot write journal %s\n", path.c_str());
+		return;
+	}
+
+	uint8_t record[record_size];
+	uint32_t sectors = 0;
+	for (auto& entry : batch) {
+		if ((int)(entry.first >> 32) != drive) { continue; }
+		uint32_t lba = (uint32_t)entry.first;
+		memcpy(record, "TKJS", 4);
+		Put32(record + 4, lba);
+		Put32(record + 8, Check(lba, entry.second.data()));
+		memcpy(record + 12, entry.second.data(), SimDiskImage::sector_size);
+		fwrite(record, 1, record_size, file);
+		sectors++;
+	}
+	memset(record, 0, record_size);
+	memcpy(record, "TKJC", 4);
+	Put32(record + 4, sectors);
+	Put32(record + 8, Check(sectors, record + 12));
+	fwrite(record, 1, record_size, file);
+
+	fflush(file);
+#ifdef WIN32
+	_commit(_fileno(file));
+#else
+	fsync(fileno(file));
+#endif
+	fclose(file);
+}
+
+int SimWriteBack::Recover(SimDiskImage& image) {
+	std::string path = image.journalPath;
+	if (path.empty()) { return 0; }
+	FILE* file = fopen(path.c_str(), "rb");
+	if (!file) { return 0; }
+
+	// Apply each batch whose commit record made it to disk
+	std::vector<uint8_t> batch;
+	uint8_t record[record_size];
+	uint32_t sectors = 0;
+	int recovered = 0;
+	while (fread(record, 1, record_size, file) == (size_t)record_size) {
+		uint32_t value = Get32(record + 4);
+		if (Get32(record + 8) != Check(value, record + 12)) { break; }
+		if (memcmp(record, "TKJS", 4) == 0) {
+			batch.insert(batch.end(), record + 4, record + record_size);
+			sectors++;
+		}
+		else if (memcmp(record, "TKJC", 4) == 0 && value == sectors) {
+			for (size_t offset = 0; offset < batch.size(); offset += record_size - 4) {
+				image.Write(Get32(&batch[offset]), &batch[offset + 8]);
+			}
+			recovered += sectors;
+			batch.clear();
+			sectors = 0;
+		}
+		else { break; }
+	}
+	fclose(file);
+
+	image.Sync();
+	remove(path.c_str());
+	if (recovered) { printf("%s: %d sectors recovered from journal\n", image.path.c_str(), recovered); }
+	return recovered;
+}
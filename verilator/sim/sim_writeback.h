@@ -0,0 +1,68 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "sim_diskimage.h"
+
+// Write-back cache for sectors written by the core.
+// Write() only copies the sector into a dirty map (a rewrite of a sector
+// still waiting replaces it), so the simulation thread never waits on the
+// host.  A worker thread flushes the map every intervalMs, or sooner once
+// maxDirty sectors are waiting or Flush() is called:
+//   1. append the batch to the image's journalPath with a commit record, and fsync it
+//   2. apply it to the images under imageLock
+//   3. SyncData() the images, then delete the journal
+// A crash between 1 and 3 leaves a journal that Recover() replays at the
+// next mount; a batch without its commit record is ignored.  The journal is
+// <image>.journal for an image written directly (which that run has locked)
+// and <delta>.journal for a file overlay, so concurrent runs never share one;
+// memory overlays are not journalled.
+struct SimWriteBack {
+public:
+
+	bool enabled;
+	bool journal;
+	int intervalMs;
+	int maxDirty;
+
+	std::atomic<int> stats_dirty;			// sectors waiting (including the batch in flight)
+	std::atomic<int> stats_coalesced;		// rewrites absorbed before reaching the image
+	std::atomic<int> stats_flushed;			// sectors applied to images
+	std::atomic<int> stats_flushes;
+	std::atomic<int> stats_syncMicros;		// duration of the last flush
+
+	SimWriteBack(SimDiskImage* disks, int count, std::mutex& imageLock);
+	~SimWriteBack();
+	void Start();
+	void Stop();				// flushes everything first
+	void Write(int drive, uint32_t lba, const uint8_t* data);
+	bool Read(int drive, uint32_t lba, uint8_t* data);
+	// Flush and fsync now; with wait, return once it is on disk
+	void Flush(bool wait);
+	static int Recover(SimDiskImage& image);
+
+private:
+	SimDiskImage* disks;
+	int count;
+	std::mutex& imageLock;
+
+	typedef std::unordered_map<uint64_t, std::vector<uint8_t>> SectorMap;
+	SectorMap dirty;
+	SectorMap flushing;			// batch being written, still visible to Read()
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable done;
+	bool flushRequested;
+	bool stopping;
+	bool flushBusy;				// worker is between taking a batch and finishing it
+	uint64_t flushGeneration;	// completed flushes, for Flush(true)
+	std::thread worker;
+
+	void Run();
+	void WriteJournal(int drive, const SectorMap& batch);
+	static uint64_t Key(int drive, uint32_t lba) { return ((uint64_t)drive << 32) | lba; }
+};
@@ -1,12 +1,15 @@
 #include <verilated.h>
 #include "Vemu.h"
+#include "Vemu__Dpi.h"
 
 #include "imgui.h"
 #include "implot.h"
 #ifndef _MSC_VER
 #include <stdio.h>
+#ifndef SIM_HEADLESS
 #include <SDL.h>
 #include <SDL_opengl.h>
+#endif
 #else
 #define WIN32
 #include <dinput.h>
@@ -19,6 +22,9 @@
 #include "sim_audio.h"
 #include "sim_input.h"
 #include "sim_clock.h"
+#include "sim_capture.h"
+#include "sim_scenario.h"
+#include "sim_memory.h"
 
 #define FMT_HEADER_ONLY
 #include <fmt/core.h>
@@ -29,12 +35,14 @@
 
 #include <iostream>
 #include <fstream>
+#include <algorithm>
 #include <sstream>
 #include <iterator>
 #include <string>
 #include <iomanip>
 #include <thread>
 #include <chrono>
+#include <csignal>
 
 using namespace std;
 
@@ -55,6 +63,13 @@ int batchSize = 650000;
 bool single_step = 0;
 bool multi_step = 0;
 int multi_step_amount = 1024;
+int stop_frame = 0;	// Headless: exit once this many frames have been output (0 = run forever)
+volatile sig_atomic_t interrupted = 0;	// SIGINT: leave the main loop and clean up (second one kills)
+
+void onInterrupt(int) {
+	interrupted = 1;
+	signal(SIGINT, SIG_DFL);
+}
 
 
 bool stop_on_log_mismatch = 1;
@@ -81,15 +96,42 @@ const char* windowTitle_Control = "Simulation control";
 const char* windowTitle_DebugLog = "Debug log";
 const char* windowTitle_Video = "VGA output";
 const char* windowTitle_Audio = "Audio output";
+const char* windowTitle_Disk = "Disk drives";
+const char* windowTitle_Memory = "Memory";
 bool showDebugLog = true;
 DebugConsole console;
 MemoryEditor mem_edit;
+int disk_dialog_drive = 0;	// drive the Insert file dialog is for
 
 // HPS emulator
 // ------------
 SimBus bus(console);
 SimBlockDevice blockdevice(console);
 
+// Core memories, accessed in place
+// --------------------------------
+SimMemory memory;
+
+// --load: programs copied into RAM once the ROM has finished booting
+struct FastLoad {
+	std::string file;
+	uint32_t address;
+};
+std::vector<FastLoad> fast_loads;
+int fast_load_frame = 120;
+bool fast_load_run = false;		// CALL the first program after loading
+
+// --rom: replaces the $readmemh image once the initial blocks have run, and
+// again after every reset; empty keeps (or restores) the built-in ROM
+std::string rom_file;
+bool rom_pending = false;
+std::vector<uint8_t> rom_builtin;
+std::string rom_error;		// last image that failed to load, shown in the GUI
+
+// --dump-every: snapshots of every memory at frame boundaries
+int dump_every = 0;
+std::string dump_prefix = "dump";
+
 // Input handling
 // --------------
 SimInput input(13, console);
@@ -116,6 +158,10 @@ const int input_menu = 12;
 #define VGA_SCALE_Y vga_scale
 SimVideo video(VGA_WIDTH, VGA_HEIGHT, VGA_ROTATE);
 float vga_scale = 2.5;
+FILE* frame_hash_file = NULL;	// --frame-hashes: one "frame hash" line per completed frame
+SimCapture capture(8);
+char capture_path[256] = "capture.y4m";
+SimScenario scenario(input, blockdevice);	// --scenario: golden-frame regression run
 
 // Verilog module
 // --------------
@@ -126,7 +172,7 @@ double sc_time_stamp() {	// Called by $time in Verilog.
 	return main_time;
 }
 
-int clk_sys_freq = 24000000;
+int clk_sys_freq = 14318181;	// TK2000.sv PLL: clk_sys is the 14.318 MHz master clock
 SimClock clk_sys(1);
 
 int soft_reset=0;
@@ -137,8 +183,17 @@ vluint64_t soft_reset_time=0;
 //#define DISABLE_AUDIO
 #ifndef DISABLE_AUDIO
 SimAudio audio(clk_sys_freq, false);
+char wav_path[256] = "audio.wav";
+SimWav_Format wav_format = SimWav_PCM16;	// --wav-format, also used by Record WAV
 #endif
 
+// Called from sim.v on every speaker toggle, during the clk_sys rising edge eval
+void sim_speaker_edge(svBit level) {
+#ifndef DISABLE_AUDIO
+	audio.SpeakerEdge(main_time, level);
+#endif
+}
+
 enum instruction_type {
 	formatted,
 	implied,
@@ -602,8 +657,12 @@ void DumpInstruction() {
 // Reset simulation variables and clocks
 void resetSim() {
 	main_time = 0;
+	rom_pending = !rom_file.empty() || !rom_builtin.empty();
 	top->reset = 1;
 	clk_sys.Reset();
+#ifndef DISABLE_AUDIO
+	audio.ResetTimeline(main_time);
+#endif
 }
 
 	//MSM6242B layout
@@ -646,6 +705,45 @@ void send_clock() {
 }
 
 
+// Copy a binary into RAM between cycles and optionally start it from BASIC
+bool fastLoad(std::string file, uint32_t address, bool run) {
+	if (!memory.Load("RAM", file, address)) { return false; }
+	console.AddLog("Loaded %s: %u bytes at $%04X in %.0f us", file.c_str(), memory.stats_loadBytes, address, memory.stats_loadMicros);
+	if (run) { input.TypeText(fmt::format("CALL {}\n", address)); }
+	return true;
+}
+
+// Called once per completed frame, right after the framebuffer has been hashed
+void frameComplete() {
+	if (dump_every && video.count_frame % dump_every == 0) { memory.DumpAll(dump_prefix, video.count_frame); }
+	if (!fast_loads.empty() && video.count_frame == fast_load_frame) {
+		for (size_t n = 0; n < fast_loads.size(); n++) { fastLoad(fast_loads[n].file, fast_loads[n].address, fast_load_run && n == 0); }
+	}
+	if (frame_hash_file) {
+		fprintf(frame_hash_file, "%d %016llx\n", video.count_frame, (unsigned long long)video.frame_hash);
+	}
+	if (capture.IsActive()) {
+		capture.PushFrame(video.output_ptr, video.count_frame, video.frame_changed);
+	}
+	if (scenario.active) {
+		scenario.Frame(video);
+	}
+}
+
+bool startCapture(std::string path, const char* format_name) {
+	SimCapture_Format format;
+	if (!SimCapture::FormatFromName(format_name ? std::string(".") + format_name : path, &format)) {
+		fprintf(stderr, "unknown capture format for %s (use y4m, raw or png)\n", path.c_str());
+		return false;
+	}
+	if (!capture.Start(path, format, video.output_width, video.output_height, 60)) {
+		fprintf(stderr, "cannot start capture to %s\n", path.c_str());
+		return false;
+	}
+	console.AddLog("Capturing to %s", path.c_str());
+	return true;
+}
+
 int verilate() {
 
 	if (!Verilated::gotFinish()) {
@@ -665,6 +763,28 @@ int verilate() {
 			fprintf(stderr,"soft_reset_time %ld initialReset %x\n",soft_reset_time,initialReset);
 		} 
 
+		// Swap the ROM while the core is still held in reset, after the first
+		// eval has run rom.v's $readmemh
+		if (rom_pending && main_time > 0 && main_time < initialReset) {
+			SimMemory_Region* rom = memory.Find("ROM");
+			if (rom_builtin.empty()) { rom_builtin.assign(rom->data, rom->data + rom->size); }
+			// Start from the built-in image so a short file doesn't leave the
+			// tail of the previous ROM behind
+			memcpy(rom->data, rom_builtin.data(), rom->size);
+			if (!rom_file.empty()) {
+				if (memory.LoadImage("ROM", rom_file)) {
+					console.AddLog("ROM: %s", rom_file.c_str());
+					rom_error.clear();
+				}
+				else {
+					console.AddLog("ROM: cannot load %s, using the built-in ROM", rom_file.c_str());
+					rom_error = rom_file;
+					rom_file.clear();
+				}
+			}
+			rom_pending = false;
+		}
+
 		// Assert reset during startup
 		if (main_time < initialReset) { top->reset = 1; }
 		// Deassert reset after startup
@@ -762,7 +882,7 @@ int verilate() {
 		}
 		
 #ifndef DISABLE_AUDIO
-		if (clk_sys.IsRising())
+		if (clk_sys.IsRising() && !audio.edgeMode)
 		{
 			audio.Clock(top->AUDIO_L, top->AUDIO_R);
 		}
@@ -771,7 +891,7 @@ int verilate() {
 		// Output pixels on rising edge of pixel clock
 		if (clk_sys.IsRising() && top->CE_PIXEL ) {
 			uint32_t colour = 0xFF000000 | top->VGA_B << 16 | top->VGA_G << 8 | top->VGA_R;
-			video.Clock(top->VGA_HB, top->VGA_VB, top->VGA_HS, top->VGA_VS, colour);
+			if (video.Clock(top->VGA_HB, top->VGA_VB, top->VGA_HS, top->VGA_VS, colour)) { frameComplete(); }
 		}
 
 		if (clk_sys.IsRising()) {
@@ -801,20 +921,136 @@ int main(int argc, char** argv, char** env) {
 	top = new Vemu();
 	Verilated::commandArgs(argc, argv);
 
+	// Harness options (Verilator +args are left to commandArgs)
+	const char* capture_file = NULL;
+	const char* capture_format = NULL;
+	const char* scenario_file = NULL;
+	const char* disk_stats_file = "disk_stats.json";
+	bool dump_at_exit = false;
+	std::string disk_files[kVDNUM];
+	bool disk_given[kVDNUM] = {};
+	disk_files[0] = "floppy.nib";
+	disk_files[1] = "hd.hdv";
+#ifndef DISABLE_AUDIO
+	const char* wav_file = NULL;
+#endif
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--frames" && i + 1 < argc) { stop_frame = atoi(argv[++i]); }
+		else if (arg == "--frame-hashes" && i + 1 < argc) {
+			frame_hash_file = fopen(argv[++i], "w");
+			if (!frame_hash_file) { fprintf(stderr, "cannot open %s\n", argv[i]); return 1; }
+		}
+		else if (arg == "--capture" && i + 1 < argc) { capture_file = argv[++i]; }
+		else if (arg == "--capture-format" && i + 1 < argc) { capture_format = argv[++i]; }
+		else if (arg == "--scenario" && i + 1 < argc) { scenario_file = argv[++i]; }
+		else if (arg == "--scenario-out" && i + 1 < argc) { scenario.outPrefix = argv[++i]; }
+		else if (arg == "--update-golden") { scenario.updateGolden = true; }
+		else if (arg == "--golden-dir" && i + 1 < argc) { scenario.goldenDir = argv[++i]; }
+		else if (arg == "--disk-latency" && i + 1 < argc) {
+			if (!SimBlockDevice::LatencyFromName(argv[++i], &blockdevice.latencyModel)) { fprintf(stderr, "unknown disk latency %s (use fixed, realistic or instant)\n", argv[i]); return 1; }
+		}
+		else if (arg == "--disk-latency-cycles" && i + 1 < argc) { blockdevice.latencyCycles = atoi(argv[++i]); }
+		else if (arg == "--overlay" && i + 1 < argc) {
+			std::string mode = argv[++i];
+			if (mode == "memory") { blockdevice.overlayMode = SimDiskImage_Memory; }
+			else if (mode == "file") { blockdevice.overlayMode = SimDiskImage_File; }
+			else if (mode == "none") { blockdevice.overlayMode = SimDiskImage_Direct; }
+			else { fprintf(stderr, "unknown overlay %s (use memory, file or none)\n", argv[i]); return 1; }
+		}
+		else if (arg == "--overlay-exit" && i + 1 < argc) {
+			std::string action = argv[++i];
+			if (action == "discard") { blockdevice.overlayExit = SimDiskImage_Discard; }
+			else if (action == "commit") { blockdevice.overlayExit = SimDiskImage_Commit; }
+			else if (action == "keep") { blockdevice.overlayExit = SimDiskImage_Keep; }
+			else { fprintf(stderr, "unknown overlay exit action %s (use discard, commit or keep)\n", argv[i]); return 1; }
+		}
+		else if (arg == "--overlay-dir" && i + 1 < argc) { blockdevice.overlayDir = argv[++i]; }
+		else if (arg == "--track-cache" && i + 1 < argc) { blockdevice.trackCache.capacity = atoi(argv[++i]); }
+		else if (arg == "--no-writeback") { blockdevice.writeback.enabled = false; }
+		else if (arg == "--writeback-interval" && i + 1 < argc) { blockdevice.writeback.intervalMs = atoi(argv[++i]); }
+		else if (arg == "--no-journal") { blockdevice.writeback.journal = false; }
+		else if ((arg == "--disk" || arg == "--playlist") && i + 2 < argc) {
+			int d = atoi(argv[++i]);
+			if (d < 0 || d >= kVDNUM) { fprintf(stderr, "%s: drive %s out of range\n", arg.c_str(), argv[i]); return 1; }
+			std::string file = argv[++i];
+			disk_given[d] = true;
+			if (arg == "--disk") { disk_files[d] = file == "none" ? "" : file; }
+			else if (!blockdevice.LoadPlaylist(d, file)) { fprintf(stderr, "empty playlist %s\n", file.c_str()); return 1; }
+			else { disk_files[d].clear(); }
+		}
+		else if (arg == "--download" && i + 2 < argc) {
+			int index = atoi(argv[++i]);
+			bus.QueueDownload(argv[++i], index, true);
+		}
+		else if (arg == "--load" && i + 1 < argc) {
+			// FILE@ADDRESS, the address in decimal, $hex or 0xhex
+			std::string spec = argv[++i];
+			size_t at = spec.find_last_of('@');
+			FastLoad load;
+			if (at == std::string::npos || !SimMemory::ParseAddress(spec.substr(at + 1), &load.address)) { fprintf(stderr, "--load expects FILE@ADDRESS, e.g. game.bin@0x6000\n"); return 1; }
+			load.file = spec.substr(0, at);
+			fast_loads.push_back(load);
+		}
+		else if (arg == "--load-frame" && i + 1 < argc) { fast_load_frame = atoi(argv[++i]); }
+		else if (arg == "--load-run") { fast_load_run = true; }
+		else if (arg == "--rom" && i + 1 < argc) {
+			rom_file = argv[++i];
+			rom_pending = true;
+		}
+		else if (arg == "--dump-every" && i + 1 < argc) { dump_every = atoi(argv[++i]); }
+		else if (arg == "--dump-prefix" && i + 1 < argc) { dump_prefix = argv[++i]; }
+		else if (arg == "--dump-exit") { dump_at_exit = true; }
+		else if (arg == "--upload" && i + 1 < argc) { bus.QueueUpload(argv[++i], 0, 0x10000); }
+		else if (arg == "--disk-stats" && i + 1 < argc) {
+			disk_stats_file = argv[++i];
+			if (!strcmp(disk_stats_file, "none")) { disk_stats_file = NULL; }
+		}
+		else if (arg == "--trace" && i + 1 < argc) {
+			// Comma separated categories of verbose logging
+			std::stringstream categories(argv[++i]);
+			std::string category;
+			while (std::getline(categories, category, ',')) {
+				if (category == "disk") { blockdevice.trace = true; }
+				else { fprintf(stderr, "unknown trace category %s (use disk)\n", category.c_str()); return 1; }
+			}
+		}
+#ifndef DISABLE_AUDIO
+		else if (arg == "--no-audio") { audio.liveOutput = false; }
+		else if (arg == "--audio-rate" && i + 1 < argc) { audio.outputRate = atoi(argv[++i]); }
+		else if (arg == "--audio-sampled") { audio.edgeMode = false; }
+		else if (arg == "--wav" && i + 1 < argc) { wav_file = argv[++i]; }
+		else if (arg == "--wav-format" && i + 1 < argc) {
+			if (!SimWavWriter::FormatFromName(argv[++i], &wav_format)) { fprintf(stderr, "unknown wav format %s (use pcm16 or float)\n", argv[i]); return 1; }
+		}
+		else if (arg == "--bench-audio") {
+			// Decimator cost per clk_sys sample, on a synthetic speaker square wave
+			for (int rate : { 44100, 48000 }) {
+				double outputs;
+				double ns = SimDecimator::Benchmark(clk_sys_freq, rate, 2.0, &outputs);
+				printf("decimator %d Hz: %.2f ns per input sample, %.1f samples/s out\n", rate, ns, outputs);
+			}
+			return 0;
+		}
+#endif
+	}
+	if (scenario_file && !scenario.Load(scenario_file)) { return 1; }
+
 #ifdef WIN32
 	// Attach debug console to the verilated code
 	Verilated::setDebug(console);
 #endif
 
 	// Attach bus
+	bus.clockFrequency = clk_sys_freq;
 	bus.ioctl_addr = &top->ioctl_addr;
 	bus.ioctl_index = &top->ioctl_index;
 	bus.ioctl_wait = &top->ioctl_wait;
 	bus.ioctl_download = &top->ioctl_download;
-	//bus.ioctl_upload = &top->ioctl_upload;
+	bus.ioctl_upload = &top->ioctl_upload;
 	bus.ioctl_wr = &top->ioctl_wr;
 	bus.ioctl_dout = &top->ioctl_dout;
-	//bus.ioctl_din = &top->ioctl_din;
+	bus.ioctl_din = &top->ioctl_din;
 	input.ps2_key = &top->ps2_key;
 
 	// hookup blk device
@@ -833,12 +1069,26 @@ int main(int argc, char** argv, char** env) {
 	blockdevice.img_mounted= &top->img_mounted;
 	blockdevice.img_readonly= &top->img_readonly;
 	blockdevice.img_size= &top->img_size;
+	blockdevice.disk_busy= &top->disk_busy;
+
+	// bram's mem is verilator public (see rtl/bram.sv)
+	memory.Add("RAM", &VERTOPINTERN->emu__DOT__ram__DOT__mem[0], 0x10000);
+	memory.Add("ROM", &VERTOPINTERN->emu__DOT__roms__DOT__d[0], 0x4000);
+	// floppy_track buffers hold one 6656 byte nibble track (13 sectors) of an 8 KB bram
+	memory.Add("Track 1", &VERTOPINTERN->emu__DOT__floppy_track_1__DOT__floppy_dpram__DOT__mem[0], kTRACKSECTORS * kBLKSZ);
+	memory.Add("Track 2", &VERTOPINTERN->emu__DOT__floppy_track_2__DOT__floppy_dpram__DOT__mem[0], kTRACKSECTORS * kBLKSZ);
+	blockdevice.Initialise();
 
 	send_clock();
 
 #ifndef DISABLE_AUDIO
 	audio.Initialise();
+	if (wav_file) {
+		if (!audio.wav.Open(wav_file, audio.outputRate, wav_format)) { fprintf(stderr, "cannot open %s\n", wav_file); return 1; }
+		strncpy(wav_path, wav_file, sizeof(wav_path) - 1);
+	}
 #endif
+	signal(SIGINT, onInterrupt);
 
 	// Set up input module
 	input.Initialise();
@@ -857,7 +1107,7 @@ int main(int argc, char** argv, char** env) {
 	input.SetMapping(input_start, DIK_2); // Start
 	input.SetMapping(input_menu, DIK_M); // System menu trigger
 
-#else
+#elif !defined(SIM_HEADLESS)
 	input.SetMapping(input_up, SDL_SCANCODE_UP);
 	input.SetMapping(input_right, SDL_SCANCODE_RIGHT);
 	input.SetMapping(input_down, SDL_SCANCODE_DOWN);
@@ -874,13 +1124,48 @@ int main(int argc, char** argv, char** env) {
 #endif
 	// Setup video output
 	if (video.Initialise(windowTitle) == 1) { return 1; }
+#ifndef SIM_HEADLESS
+	ImPlot::CreateContext();
+#endif
+	if (capture_file && !startCapture(capture_file, capture_format)) { return 1; }
 
 
         //bus.QueueDownload("floppy.nib",1,0);
-	blockdevice.MountDisk("floppy.nib",0);
-	//blockdevice.MountDisk("floppy2.nib",2);
-	blockdevice.MountDisk("hd.hdv",1);
+	if (scenario_file) {
+		// The scenario mounts its own media
+		scenario.Start();
+	}
+	else {
+		// --disk and --playlist replace the default for their drive
+		for (int d = 0; d < kVDNUM; d++) {
+			if (disk_given[d] && !blockdevice.playlist[d].empty()) { blockdevice.SelectDisk(d, 0); }
+			else if (!disk_files[d].empty()) { blockdevice.MountDisk(disk_files[d], d); }
+		}
+	}
 
+#ifdef SIM_HEADLESS
+	// Headless: no window or GUI, just run the core and keep producing frames
+	auto headless_start = std::chrono::steady_clock::now();
+	bool done = false;
+	while (!done)
+	{
+		for (int step = 0; step < batchSize && !done; step++) {
+			verilate();
+			if (stop_frame && video.count_frame >= stop_frame) { done = true; }
+			if (scenario.finished) { done = true; }
+			if (interrupted) { done = true; }
+		}
+#ifndef DISABLE_AUDIO
+		audio.Advance(main_time);
+#endif
+		video.UpdateTexture();
+	}
+	double headless_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - headless_start).count();
+	printf("headless: %d frames, main_time %ld, %.2fs (%.2f frames/s)\n", video.count_frame, (long)main_time, headless_secs, video.count_frame / headless_secs);
+	printf("disk: %d sectors read, %d written, %llu cycles awaiting ack, track busy %llu/%llu cycles, cpu wait %llu cycles\n", blockdevice.stats_reads, blockdevice.stats_writes, (unsigned long long)blockdevice.stats_latency, (unsigned long long)blockdevice.stats_trackBusy[0], (unsigned long long)blockdevice.stats_trackBusy[1], (unsigned long long)blockdevice.stats_cpuWait);
+	if (bus.stats_bytes) { printf("download: %s %llu bytes, %.0f KB/emulated s, %.0f KB/s wall, wait %llu cycles\n", bus.stats_file.c_str(), (unsigned long long)bus.stats_bytes, bus.BytesPerEmulatedSecond() / 1024, bus.BytesPerWallSecond() / 1024, (unsigned long long)bus.stats_waitCycles); }
+	printf("track cache: %d hits, %d misses, %d prefetched, %d used\n", blockdevice.trackCache.stats_hits, blockdevice.trackCache.stats_misses, blockdevice.trackCache.stats_prefetches, blockdevice.trackCache.stats_prefetchHits);
+#else
 #ifdef WIN32
 	MSG msg;
 	ZeroMemory(&msg, sizeof(msg));
@@ -904,6 +1189,7 @@ int main(int argc, char** argv, char** env) {
 				done = true;
 		}
 #endif
+		if (interrupted) { break; }
 		video.StartFrame();
 
 		input.Read();
@@ -931,6 +1217,46 @@ int main(int argc, char** argv, char** env) {
 		//ImGui::SameLine();
 		ImGui::SliderInt("Multi step amount", &multi_step_amount, 8, 1024);
 		if (ImGui::Button("Soft Reset")) { fprintf(stderr,"soft reset\n"); soft_reset=1; } ImGui::SameLine();
+		static char load_address[16] = "$6000";
+		static bool load_run = false;
+		if (ImGui::Button("Fast load...")) { ImGuiFileDialog::Instance()->OpenDialog("ChooseLoadDlgKey", "Load binary into RAM", ".*,.bin,.b,.obj", ".", ""); }
+		ImGui::SameLine(); ImGui::SetNextItemWidth(80);
+		ImGui::InputText("at", load_address, sizeof(load_address));
+		ImGui::SameLine();
+		ImGui::Checkbox("CALL it", &load_run);
+		if (memory.stats_loads) { ImGui::SameLine(); ImGui::Text("%u bytes, %.0f us", memory.stats_loadBytes, memory.stats_loadMicros); }
+		if (ImGui::Button("Load ROM...")) { ImGuiFileDialog::Instance()->OpenDialog("ChooseRomDlgKey", "Load ROM (applied on reset)", ".*,.bin,.rom,.hex,.mem", "ROMs/TK2000", ""); }
+		ImGui::SameLine();
+		if (ImGui::Button("Built-in ROM")) { rom_file.clear(); rom_error.clear(); resetSim(); }
+		ImGui::SameLine();
+		ImGui::Text("ROM: %s", rom_file.empty() ? "built-in" : rom_file.c_str());
+		if (!rom_error.empty()) { ImGui::SameLine(); ImGui::TextColored(ImVec4(1, 0.3f, 0.3f, 1), "cannot load %s", rom_error.c_str()); }
+		if (ImGuiFileDialog::Instance()->Display("ChooseRomDlgKey", ImGuiWindowFlags_NoCollapse, ImVec2(500, 300))) {
+			if (ImGuiFileDialog::Instance()->IsOk()) {
+				rom_file = ImGuiFileDialog::Instance()->GetFilePathName();
+				resetSim();
+			}
+			ImGuiFileDialog::Instance()->Close();
+		}
+		if (ImGui::Button("Dump RAM/ROM")) {
+			int written = memory.DumpAll(dump_prefix, video.count_frame);
+			console.AddLog("Dumped %d memories to %s_*_%d.bin in %.0f us", written, dump_prefix.c_str(), video.count_frame, memory.stats_dumpMicros);
+		}
+		ImGui::SameLine();
+		if (ImGui::Button("Upload RAM (ioctl)") && !bus.Uploading()) { bus.QueueUpload(fmt::format("{}_ram_ioctl_{}.bin", dump_prefix, video.count_frame), 0, 0x10000); }
+		ImGui::SameLine(); ImGui::SetNextItemWidth(80);
+		ImGui::InputInt("Dump every N frames", &dump_every);
+		if (dump_every < 0) { dump_every = 0; }
+		if (ImGuiFileDialog::Instance()->Display("ChooseLoadDlgKey", ImGuiWindowFlags_NoCollapse, ImVec2(500, 300))) {
+			uint32_t address;
+			if (ImGuiFileDialog::Instance()->IsOk()) {
+				if (SimMemory::ParseAddress(load_address, &address)) { fastLoad(ImGuiFileDialog::Instance()->GetFilePathName(), address, load_run); }
+				else { console.AddLog("Bad load address %s", load_address); }
+			}
+			ImGuiFileDialog::Instance()->Close();
+		}
+		if (bus.Downloading()) { ImGui::Text("download: %s %llu/%llu bytes", bus.stats_file.c_str(), (unsigned long long)bus.stats_bytes, (unsigned long long)bus.DownloadSize()); }
+		else if (bus.stats_bytes) { ImGui::Text("download: %s %llu bytes, %.0f KB/emulated s, %.0f KB/s wall, wait %llu cycles", bus.stats_file.c_str(), (unsigned long long)bus.stats_bytes, bus.BytesPerEmulatedSecond() / 1024, bus.BytesPerWallSecond() / 1024, (unsigned long long)bus.stats_waitCycles); }
 
 		ImGui::End();
 
@@ -938,58 +1264,168 @@ int main(int argc, char** argv, char** env) {
 		console.Draw(windowTitle_DebugLog, &showDebugLog, ImVec2(500, 700));
 		ImGui::SetWindowPos(windowTitle_DebugLog, ImVec2(0, 160), ImGuiCond_Once);
 
-		// Memory debug
-		//ImGui::Begin("PGROM Editor");
-		//mem_edit.DrawContents(top->emu__DOT__system__DOT__pgrom__DOT__mem, 32768, 0);
-		//ImGui::End();
-		//ImGui::Begin("CHROM Editor");
-		//mem_edit.DrawContents(top->emu__DOT__system__DOT__chrom__DOT__mem, 2048, 0);
-		//ImGui::End();
-		//ImGui::Begin("WKRAM Editor");
-		//mem_edit.DrawContents(&top->emu__DOT__system__DOT__wkram__DOT__mem, 16384, 0);
-		//ImGui::End();
-		//ImGui::Begin("CHRAM Editor");
-		//mem_edit.DrawContents(&top->emu__DOT__system__DOT__chram__DOT__mem, 2048, 0);
-		//ImGui::End();
-		//ImGui::Begin("FGCOLRAM Editor");
-		//mem_edit.DrawContents(&top->emu__DOT__system__DOT__fgcolram__DOT__mem, 2048, 0);
-		//ImGui::End();
-		//ImGui::Begin("BGCOLRAM Editor");
-		//mem_edit.DrawContents(&top->emu__DOT__system__DOT__bgcolram__DOT__mem, 2048, 0);
-		//ImGui::End();
-		//ImGui::Begin("Sprite RAM");
-		//mem_edit.DrawContents(&top->emu__DOT__system__DOT__spriteram__DOT__mem, 96, 0);
-		//ImGui::End();
-		//ImGui::Begin("Sprite Linebuffer RAM");
-		//mem_edit.DrawContents(&top->emu__DOT__system__DOT__spritelbram__DOT__mem, 1024, 0);
-		//ImGui::End();
-		//ImGui::Begin("Sprite Collision Buffer RAM A");
-		//mem_edit.DrawContents(&top->emu__DOT__system__DOT__comet__DOT__spritecollisionbufferram_a__DOT__mem, 512, 0);
-		//ImGui::End();
-		//ImGui::Begin("Sprite Collision Buffer RAM B");
-		//mem_edit.DrawContents(&top->emu__DOT__system__DOT__comet__DOT__spritecollisionbufferram_b__DOT__mem, 512, 0);
-		//ImGui::End();
-		//ImGui::Begin("Sprite Collision RAM ");
-		//mem_edit.DrawContents(&top->emu__DOT__system__DOT__spritecollisionram__DOT__mem, 32, 0);
-		//ImGui::End();
-		//ImGui::Begin("Sprite Debug RAM");
-		//mem_edit.DrawContents(&top->emu__DOT__system__DOT__spritedebugram__DOT__mem, 128000, 0);
-		//ImGui::End();
-		//ImGui::Begin("Palette ROM");
-		//mem_edit.DrawContents(&top->emu__DOT__system__DOT__palrom__DOT__mem, 64, 0);
-		//ImGui::End();
-		//ImGui::Begin("Sprite ROM");
-		//mem_edit.DrawContents(&top->emu__DOT__system__DOT__spriterom__DOT__mem, 2048, 0);
-		//ImGui::End();
-		//ImGui::Begin("Tilemap ROM");
-		//mem_edit.DrawContents(&top->emu__DOT__system__DOT__tilemaprom__DOT__mem, 8192, 0);
-		//ImGui::End();
-		//ImGui::Begin("Tilemap RAM");
-		//	mem_edit.DrawContents(&top->emu__DOT__system__DOT__tilemapram__DOT__mem, 768, 0);
-		//ImGui::End();
-		//ImGui::Begin("Sound ROM");
-		//mem_edit.DrawContents(&top->emu__DOT__system__DOT__soundrom__DOT__mem, 64000, 0);
-		//ImGui::End();
+		// Disk window
+		ImGui::Begin(windowTitle_Disk);
+		ImGui::SetWindowPos(windowTitle_Disk, ImVec2(0, 870), ImGuiCond_Once);
+		ImGui::SetWindowSize(windowTitle_Disk, ImVec2(500, 200), ImGuiCond_Once);
+		static const char* latency_names[] = { "Fixed", "Realistic SD", "Instant" };
+		int latency = blockdevice.latencyModel;
+		ImGui::SetNextItemWidth(140);
+		if (ImGui::Combo("Latency", &latency, latency_names, 3)) { blockdevice.latencyModel = (SimBlockDevice_Latency)latency; }
+		if (blockdevice.latencyModel != SimBlockDevice_Instant) {
+			ImGui::SameLine(); ImGui::SetNextItemWidth(160);
+			ImGui::SliderInt("Cycles", &blockdevice.latencyCycles, 1, 100000, "%d", ImGuiSliderFlags_Logarithmic);
+		}
+		ImGui::Text("sectors read: %d  written: %d  awaiting ack: %llu cycles  overlapped: %llu", blockdevice.stats_reads, blockdevice.stats_writes, (unsigned long long)blockdevice.stats_latency, (unsigned long long)blockdevice.stats_overlap);
+		ImGui::Text("track buffer busy: D1 %llu  D2 %llu cycles (%.1f ms)", (unsigned long long)blockdevice.stats_trackBusy[0], (unsigned long long)blockdevice.stats_trackBusy[1], (blockdevice.stats_trackBusy[0] + blockdevice.stats_trackBusy[1]) * 1000.0 / clk_sys_freq);
+		ImGui::Text("CPU held by cpu_wait_fdd: %llu cycles", (unsigned long long)blockdevice.stats_cpuWait);
+		SimWriteBack& writeback = blockdevice.writeback;
+		if (writeback.enabled) {
+			if (ImGui::SmallButton("Flush now")) { writeback.Flush(false); }
+			ImGui::SameLine();
+			ImGui::Text("write-back: %d dirty, %d coalesced, %d flushed in %d flushes, last %.1f ms", writeback.stats_dirty.load(), writeback.stats_coalesced.load(), writeback.stats_flushed.load(), writeback.stats_flushes.load(), writeback.stats_syncMicros / 1000.0f);
+		}
+		SimTrackCache& tracks = blockdevice.trackCache;
+		int track_loads = tracks.stats_hits + tracks.stats_misses;
+		ImGui::Text("track cache: %d hits, %d misses (%.0f%% hit)  prefetched %d, used %d", tracks.stats_hits, tracks.stats_misses, track_loads ? tracks.stats_hits * 100.0f / track_loads : 0.0f, tracks.stats_prefetches, tracks.stats_prefetchHits);
+		for (int d = 0; d < kVDNUM; d++) {
+			SimDiskImage& image = blockdevice.disk[d];
+			if (!blockdevice.sd_lba[d]) { continue; }
+			ImGui::PushID(d);
+			// Hot swap: the core sees an img_mounted pulse, no reset needed
+			if (ImGui::SmallButton("Insert...")) {
+				disk_dialog_drive = d;
+				ImGuiFileDialog::Instance()->OpenDialog("ChooseDiskDlgKey", "Insert disk", ".*,.nib,.dsk,.do,.po,.woz,.hdv", ".", "");
+			}
+			ImGui::SameLine();
+			if (ImGui::SmallButton("Eject")) { blockdevice.EjectDisk(d); }
+			std::vector<std::string>& playlist = blockdevice.playlist[d];
+			if (!playlist.empty()) {
+				int position = blockdevice.playlistPos[d];
+				ImGui::SameLine();
+				if (ImGui::ArrowButton("prev", ImGuiDir_Left)) { blockdevice.SelectDisk(d, position - 1); }
+				ImGui::SameLine();
+				if (ImGui::ArrowButton("next", ImGuiDir_Right)) { blockdevice.SelectDisk(d, position + 1); }
+				ImGui::SameLine();
+				ImGui::SetNextItemWidth(160);
+				std::string current = position >= 0 ? fmt::format("{}/{} {}", position + 1, playlist.size(), playlist[position].substr(playlist[position].find_last_of("/\\") + 1)) : "-";
+				if (ImGui::BeginCombo("##playlist", current.c_str())) {
+					for (int n = 0; n < (int)playlist.size(); n++) {
+						if (ImGui::Selectable(playlist[n].c_str(), n == position)) { blockdevice.SelectDisk(d, n); }
+					}
+					ImGui::EndCombo();
+				}
+			}
+			ImGui::SameLine();
+			if (!image.IsOpen()) {
+				ImGui::Text("%d: (empty)", d);
+				ImGui::PopID();
+				continue;
+			}
+			ImGui::Text("%d: %s%s", d, image.path.c_str(), image.readonly ? " (read-only)" : "");
+			if (image.format != SimDiskImage_Raw) {
+				float total = 0, slowest = 0;
+				for (float micros : image.stats_trackMicros) { total += micros; slowest = std::max(slowest, micros); }
+				ImGui::Text("   %s: %d tracks built (avg %.0f us, max %.0f us), %d written back", image.format == SimDiskImage_WOZ ? "WOZ" : "nibblized",
+					image.stats_tracksEncoded, image.stats_tracksEncoded ? total / image.stats_tracksEncoded : 0.0f, slowest, image.stats_tracksDecoded);
+			}
+			if (blockdevice.overlayMode != SimDiskImage_Direct) {
+				ImGui::SameLine(); ImGui::Text("overlay %d sectors", image.DeltaSectors());
+				ImGui::SameLine();
+				if (ImGui::SmallButton("Commit")) {
+					blockdevice.writeback.Flush(true);
+					std::lock_guard<std::mutex> guard(blockdevice.imageLock);
+					image.Commit();
+				}
+				ImGui::SameLine();
+				if (ImGui::SmallButton("Discard")) {
+					blockdevice.writeback.Flush(true);
+					std::lock_guard<std::mutex> guard(blockdevice.imageLock);
+					image.Discard();
+					blockdevice.trackCache.Invalidate(d);
+				}
+			}
+			ImGui::PopID();
+		}
+		if (ImGui::CollapsingHeader("Request statistics")) {
+			if (ImGui::BeginTable("drive_stats", 7, ImGuiTableFlags_Borders | ImGuiTableFlags_SizingFixedFit)) {
+				const char* headers[] = { "Drive", "Reads", "Writes", "KB in/out", "Seeks", "Cached", "Ack p50/p99" };
+				for (const char* header : headers) { ImGui::TableSetupColumn(header); }
+				ImGui::TableHeadersRow();
+				for (int d = 0; d < kVDNUM; d++) {
+					SimBlockDevice_Stats& s = blockdevice.stats_drive[d];
+					if (!s.reads && !s.writes && !blockdevice.disk[d].IsOpen()) { continue; }
+					ImGui::TableNextRow();
+					ImGui::TableNextColumn(); ImGui::Text("%d", d);
+					ImGui::TableNextColumn(); ImGui::Text("%llu", (unsigned long long)s.reads);
+					ImGui::TableNextColumn(); ImGui::Text("%llu", (unsigned long long)s.writes);
+					ImGui::TableNextColumn(); ImGui::Text("%llu/%llu", (unsigned long long)s.bytesRead / 1024, (unsigned long long)s.bytesWritten / 1024);
+					ImGui::TableNextColumn(); ImGui::Text("%llu", (unsigned long long)s.seeks);
+					ImGui::TableNextColumn(); ImGui::Text("%llu", (unsigned long long)s.cacheHits);
+					ImGui::TableNextColumn(); ImGui::Text("%llu/%llu", (unsigned long long)s.ackLatency.Percentile(0.5), (unsigned long long)s.ackLatency.Percentile(0.99));
+				}
+				ImGui::EndTable();
+			}
+			// Histograms for one drive, buckets are powers of two cycles
+			static int histogram_drive = 0;
+			ImGui::SetNextItemWidth(100);
+			ImGui::SliderInt("Drive", &histogram_drive, 0, kVDNUM - 1);
+			SimBlockDevice_Stats& s = blockdevice.stats_drive[histogram_drive];
+			const char* histogram_titles[] = { "Ack latency (log2 cycles)", "Request spacing (log2 cycles)" };
+			SimHistogram* histograms[] = { &s.ackLatency, &s.spacing };
+			float plotWidth = (ImGui::GetContentRegionAvail().x - ImGui::GetStyle().ItemSpacing.x) * 0.5f;
+			for (int h = 0; h < 2; h++) {
+				if (h) { ImGui::SameLine(); }
+				float counts[SimHistogram::buckets];
+				for (int b = 0; b < SimHistogram::buckets; b++) { counts[b] = (float)histograms[h]->count[b]; }
+				if (ImPlot::BeginPlot(histogram_titles[h], ImVec2(plotWidth, 160), ImPlotFlags_NoLegend | ImPlotFlags_NoMenus)) {
+					ImPlot::SetupAxes(NULL, NULL, ImPlotAxisFlags_AutoFit, ImPlotAxisFlags_AutoFit);
+					ImPlot::PlotBars("", counts, SimHistogram::buckets, 0.8);
+					ImPlot::EndPlot();
+				}
+			}
+			ImGui::Text("mean ack %.0f cycles (%.1f us), mean spacing %.0f cycles", s.ackLatency.Mean(), s.ackLatency.Mean() * 1e6 / clk_sys_freq, s.spacing.Mean());
+			if (ImGui::SmallButton("Reset statistics")) {
+				for (int d = 0; d < kVDNUM; d++) {
+					std::string image = blockdevice.stats_drive[d].image;
+					blockdevice.stats_drive[d] = SimBlockDevice_Stats();
+					blockdevice.stats_drive[d].image = image;
+				}
+			}
+		}
+		ImGui::End();
+
+		// Memory editors: the verilated arrays are drawn in place, and only the
+		// open tab's visible rows are read, so leaving this open costs nothing
+		// per cycle.  Editing is only allowed while the core is stopped.
+		ImGui::Begin(windowTitle_Memory);
+		ImGui::SetWindowPos(windowTitle_Memory, ImVec2(1100, 870), ImGuiCond_Once);
+		ImGui::SetWindowSize(windowTitle_Memory, ImVec2(560, 300), ImGuiCond_Once);
+		if (ImGui::BeginTabBar("memories")) {
+			for (size_t r = 0; r < memory.regions.size(); r++) {
+				SimMemory_Region& region = memory.regions[r];
+				if (ImGui::BeginTabItem(region.name.c_str())) {
+					mem_edit.ReadOnly = run_enable;
+					mem_edit.DrawContents(region.data, region.size, 0);
+					ImGui::EndTabItem();
+				}
+			}
+			if (ImGui::BeginTabItem("Soft switches")) {
+				static const char* switch_names[8] = { "COLOR", "MOTOR A", "PAGE 2", "MOTOR B", "LPT STB", "ROM/RAM", "(6)", "CTRL" };
+				CData& switches = VERTOPINTERN->emu__DOT__tk2000__DOT__softswitches_s;
+				ImGui::BeginDisabled(run_enable);
+				for (int bit = 0; bit < 8; bit++) {
+					bool on = (switches >> bit) & 1;
+					if (ImGui::Checkbox(fmt::format("${0:04X}/{1:04X} {2}", 0xC050 + bit * 2, 0xC051 + bit * 2, switch_names[bit]).c_str(), &on)) {
+						switches = on ? (switches | (1 << bit)) : (switches & ~(1 << bit));
+					}
+				}
+				ImGui::EndDisabled();
+				ImGui::EndTabItem();
+			}
+			ImGui::EndTabBar();
+		}
+		ImGui::End();
 
 		int windowX = 550;
 		int windowWidth = (VGA_WIDTH * VGA_SCALE_X) + 24;
@@ -1004,28 +1440,34 @@ int main(int argc, char** argv, char** env) {
 		ImGui::SliderInt("Rotate", &video.output_rotate, -1, 1); ImGui::SameLine();
 		ImGui::Checkbox("Flip V", &video.output_vflip);
 		ImGui::Text("main_time: %ld frame_count: %d sim FPS: %f", main_time, video.count_frame, video.stats_fps);
+		ImGui::Text("frame hash: %016llx uploads: %d skipped: %d rows: %d in %d spans", (unsigned long long)video.frame_hash, video.stats_uploads, video.stats_uploadsSkipped, video.stats_uploadRows, video.stats_uploadSpans);
+		ImGui::InputText("##capture", capture_path, sizeof(capture_path));
+		if (ImGui::IsItemHovered()) { ImGui::SetTooltip(".y4m: BT.601 YUV, colours are not exact\n.raw / .png: bit exact RGBA"); }
+		ImGui::SameLine();
+		if (!capture.IsActive()) {
+			if (ImGui::Button("Start capture")) { startCapture(capture_path, NULL); }
+		}
+		else {
+			if (ImGui::Button("Stop capture")) { capture.Stop(); }
+			ImGui::SameLine();
+			ImGui::Text("written: %d unchanged: %d dropped: %d", capture.stats_captured.load(), capture.stats_repeated, capture.stats_dropped);
+		}
+		if (scenario.active) {
+			if (!scenario.finished) { ImGui::Text("scenario: running, %d checks passed", scenario.stats_checked); }
+			else if (scenario.failFrame >= 0) { ImGui::TextColored(ImVec4(1, 0.3f, 0.3f, 1), "scenario: mismatch at frame %d", scenario.failFrame); }
+			else { ImGui::Text("scenario: passed, %d checks", scenario.stats_checked); }
+		}
 		//ImGui::Text("pixel: %06d line: %03d", video.count_pixel, video.count_line);
 
 		// Draw VGA output
 		ImGui::Image(video.texture_id, ImVec2(video.output_width * VGA_SCALE_X, video.output_height * VGA_SCALE_Y));
 		ImGui::End();
 
-  if (ImGuiFileDialog::Instance()->Display("ChooseFileDlgKey"))
-  {
-    // action if OK
-    if (ImGuiFileDialog::Instance()->IsOk())
-    {
-      std::string filePathName = ImGuiFileDialog::Instance()->GetFilePathName();
-      std::string filePath = ImGuiFileDialog::Instance()->GetCurrentPath();
-      // action
-fprintf(stderr,"filePathName: %s\n",filePathName.c_str());
-fprintf(stderr,"filePath: %s\n",filePath.c_str());
-     bus.QueueDownload(filePathName, 1,0);
-    }
-   
-    // close
-    ImGuiFileDialog::Instance()->Close();
-  }
+		if (ImGuiFileDialog::Instance()->Display("ChooseDiskDlgKey", ImGuiWindowFlags_NoCollapse, ImVec2(500, 300)))
+		{
+			if (ImGuiFileDialog::Instance()->IsOk()) { blockdevice.MountDisk(ImGuiFileDialog::Instance()->GetFilePathName(), disk_dialog_drive); }
+			ImGuiFileDialog::Instance()->Close();
+		}
 
 
 #ifndef DISABLE_AUDIO
@@ -1040,26 +1482,49 @@ fprintf(stderr,"filePath: %s\n",filePath.c_str());
 		//ImGui::ProgressBar(vol_l + 0.5f, ImVec2(200, 16), 0); ImGui::SameLine();
 		//ImGui::ProgressBar(vol_r + 0.5f, ImVec2(200, 16), 0);
 
-		int ticksPerSec = (24000000 / 60);
-		if (run_enable) {
-			audio.CollectDebug((signed short)top->AUDIO_L, (signed short)top->AUDIO_R);
-		}
 		int channelWidth = (windowWidth / 2)  -16;
-		ImPlot::CreateContext();
-		if (ImPlot::BeginPlot("Audio - L", ImVec2(channelWidth, 220), ImPlotFlags_NoLegend | ImPlotFlags_NoMenus | ImPlotFlags_NoTitle)) {
-			ImPlot::SetupAxes("T", "A", ImPlotAxisFlags_NoLabel | ImPlotAxisFlags_NoTickMarks, ImPlotAxisFlags_AutoFit | ImPlotAxisFlags_NoLabel | ImPlotAxisFlags_NoTickMarks);
-			ImPlot::SetupAxesLimits(0, 1, -1, 1, ImPlotCond_Once);
-			ImPlot::PlotStairs("", audio.debug_positions, audio.debug_wave_l, audio.debug_max_samples, audio.debug_pos);
-			ImPlot::EndPlot();
+		ImGui::SliderFloat("Volume", &audio.volume, 0, 2); ImGui::SameLine();
+		ImGui::Text("%d Hz  buffer: %3.0f%%  rate: %+.3f%%  underruns: %d  overruns: %d", audio.outputRate, audio.stats_fill * 100, (audio.stats_ratio - 1) * 100, audio.stats_underruns.load(), audio.stats_overruns);
+		if (audio.edgeMode) { ImGui::SameLine(); ImGui::Text("speaker edges: %d", audio.stats_edges); }
+		ImGui::InputText("##wav", wav_path, sizeof(wav_path)); ImGui::SameLine();
+		if (!audio.wav.IsOpen()) {
+			if (ImGui::Button("Record WAV") && !audio.wav.Open(wav_path, audio.outputRate, wav_format)) {
+				console.AddLog("Cannot open %s", wav_path);
+			}
 		}
-		ImGui::SameLine();
-		if (ImPlot::BeginPlot("Audio - R", ImVec2(channelWidth, 220), ImPlotFlags_NoLegend | ImPlotFlags_NoMenus | ImPlotFlags_NoTitle)) {
-			ImPlot::SetupAxes("T", "A", ImPlotAxisFlags_NoLabel | ImPlotAxisFlags_NoTickMarks, ImPlotAxisFlags_AutoFit | ImPlotAxisFlags_NoLabel | ImPlotAxisFlags_NoTickMarks);
-			ImPlot::SetupAxesLimits(0, 1, -1, 1, ImPlotCond_Once);
-			ImPlot::PlotStairs("", audio.debug_positions, audio.debug_wave_r, audio.debug_max_samples, audio.debug_pos);
-			ImPlot::EndPlot();
+		else {
+			if (ImGui::Button("Stop WAV")) { audio.wav.Close(); }
+			ImGui::SameLine();
+			ImGui::Text("%.1fs written", audio.wav.stats_frames.load() / (double)audio.outputRate);
+		}
+		// Triggered scope over the output stream
+		static const char* trigger_names[] = { "Free run", "Rising", "Falling" };
+		int trigger = audio.scope.trigger;
+		ImGui::SetNextItemWidth(100);
+		if (ImGui::Combo("Trigger", &trigger, trigger_names, 3)) { audio.scope.trigger = (SimAudioScope_Trigger)trigger; }
+		ImGui::SameLine(); ImGui::SetNextItemWidth(120);
+		ImGui::SliderFloat("Level", &audio.scope.triggerLevel, -1, 1);
+		ImGui::SameLine(); ImGui::SetNextItemWidth(160);
+		float timebase = audio.scope.window * 1000.0f / audio.outputRate;
+		if (ImGui::SliderFloat("Window (ms)", &timebase, 1, 500, "%.1f", ImGuiSliderFlags_Logarithmic)) {
+			audio.scope.window = (int)(timebase * audio.outputRate / 1000.0f) + 1;
+		}
+		ImGui::SameLine(); ImGui::Checkbox("Hold", &audio.scope.hold);
+		ImGui::SameLine(); ImGui::TextColored(audio.scope.triggered ? ImVec4(0.3f, 1, 0.3f, 1) : ImVec4(0.6f, 0.6f, 0.6f, 1), audio.scope.triggered ? "TRIG" : "AUTO");
+		int scope_count = audio.scope.Capture(audio.outputRate);
+		const char* scope_titles[] = { "Audio - L", "Audio - R" };
+		for (int channel = 0; channel < 2; channel++) {
+			if (channel) { ImGui::SameLine(); }
+			if (ImPlot::BeginPlot(scope_titles[channel], ImVec2(channelWidth, 220), ImPlotFlags_NoLegend | ImPlotFlags_NoMenus | ImPlotFlags_NoTitle)) {
+				ImPlot::SetupAxes("ms", "A", ImPlotAxisFlags_AutoFit | ImPlotAxisFlags_NoLabel, ImPlotAxisFlags_NoLabel | ImPlotAxisFlags_NoTickMarks);
+				ImPlot::SetupAxesLimits(0, 1, -1, 1, ImPlotCond_Once);
+				if (scope_count) {
+					const std::vector<float>& wave = channel ? audio.scope.view_r : audio.scope.view_l;
+					ImPlot::PlotLine("", audio.scope.view_t.data(), wave.data(), scope_count);
+				}
+				ImPlot::EndPlot();
+			}
 		}
-		ImPlot::DestroyContext();
 		ImGui::End();
 #endif
 
@@ -1119,7 +1584,11 @@ fprintf(stderr,"filePath: %s\n",filePath.c_str());
 				for (int step = 0; step < multi_step_amount; step++) { verilate(); }
 			}
 		}
+#ifndef DISABLE_AUDIO
+		audio.Advance(main_time);
+#endif
 	}
+#endif
 
 	// Clean up before exit
 	// --------------------
@@ -1127,8 +1596,16 @@ fprintf(stderr,"filePath: %s\n",filePath.c_str());
 #ifndef DISABLE_AUDIO
 	audio.CleanUp();
 #endif 
+	capture.Stop();
+	if (dump_at_exit) { memory.DumpAll(dump_prefix, -1); }
+	blockdevice.CleanUp();
+	if (disk_stats_file && !blockdevice.WriteStats(disk_stats_file, clk_sys_freq)) { fprintf(stderr, "cannot write %s\n", disk_stats_file); }
+#ifndef SIM_HEADLESS
+	ImPlot::DestroyContext();
+#endif
 	video.CleanUp();
 	input.CleanUp();
+	if (frame_hash_file) { fclose(frame_hash_file); }
 
-	return 0;
+	return scenario.ExitCode();
 }